@@ -0,0 +1,309 @@
+#include "VMesh/model.hpp"
+#include "VMesh/voxelGrid.hpp"
+
+#include "octree.hpp"
+#include "sparseVoxels.hpp"
+#include "vm8View.hpp"
+#include "meshCache.hpp"
+#include "proceduralMeshes.hpp"
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <chrono>
+#include <optional>
+#include <filesystem>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <format>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+// Traversal of the written octree in one node layout, averaged per lookup
+struct LayoutResult {
+  std::string layout;
+  Vm8View::TraversalStats traversal;
+};
+
+struct Result {
+  std::string mesh, method;
+  uint triangles, resolution, subdivisionLevel;
+  double voxelizeSeconds, octreeSeconds, attachSeconds, indicesSeconds, writeSeconds;
+  uint64_t voxels, nodes, bytes;
+  std::vector<LayoutResult> layouts;
+
+  double getTotalSeconds() const {
+    return voxelizeSeconds + octreeSeconds + attachSeconds + indicesSeconds + writeSeconds;
+  }
+};
+
+template<class T>
+static std::optional<std::vector<T>> parseList(const std::string& pStr) {
+  std::vector<T> values;
+  std::stringstream ss(pStr);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    std::stringstream itemSS(item);
+    T value;
+    if (!(itemSS >> value)) return std::nullopt;
+    values.push_back(value);
+  }
+  if (values.empty()) return std::nullopt;
+  return values;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point pStart) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - pStart).count();
+}
+
+// Same proportional fit as vmesh so voxel counts match a real run
+static void fitModel(VMesh::Model& pModel, uint pResolution) {
+  glm::vec3 smallest, largest;
+  getMeshBounds(getMeshViews(pModel), smallest, largest);
+  const glm::mat4 m = getFitMatrix(smallest, largest, pResolution, "proportional");
+  for (uint i = 0; i < pModel.getNumMeshes(); ++i)
+    pModel.getMesh(i).transformVertices(m);
+}
+
+// Runs the vm8 pipeline serially, timing each stage summed over subdivisions, then writes the octree in every layout to measure traversals
+static Result run(VMesh::Model& pModel, const std::string& pMethod, uint pResolution, uint pSubdivisionLevel, uint pLookups, const std::filesystem::path& pOut) {
+  Result r{};
+  r.method = pMethod;
+  r.resolution = pResolution;
+  r.subdivisionLevel = pSubdivisionLevel;
+  r.triangles = pModel.getTriCount();
+
+  const uint subdivisionSize = pResolution >> pSubdivisionLevel;
+  const uint subdimensions = 1 << pSubdivisionLevel;
+  const uint numSubdivisions = subdimensions * subdimensions * subdimensions;
+
+  std::optional<VMesh::VoxelGrid> grid;
+  if (pMethod != "sparse") {
+    grid.emplace(subdivisionSize);
+    grid->mPalette.addColour({1,1,1});
+  }
+
+  Octree parent(pResolution, 1);
+  for (uint subdivision = 0; subdivision < numSubdivisions; ++subdivision) {
+    glm::uvec3 origin(subdivision / (subdimensions * subdimensions), (subdivision / subdimensions) % subdimensions, subdivision % subdimensions);
+    origin *= subdivisionSize;
+
+    std::optional<Octree> svo;
+    auto start = std::chrono::steady_clock::now();
+    if (grid) {
+      uint trisComplete = 0;
+      grid->clear();
+      grid->setOrigin(origin);
+      if (pMethod == "dda") grid->DDAvoxelizeModel(pModel, &trisComplete, false, false, 0);
+      else                  grid->IntersectVoxelizeModel(pModel, &trisComplete);
+      r.voxelizeSeconds += secondsSince(start);
+      const uint64_t voxelCount = grid->getVoxelCount();
+      r.voxels += voxelCount;
+      if (!voxelCount) continue;
+
+      start = std::chrono::steady_clock::now();
+      grid->setOrigin();
+      svo.emplace(*grid);
+    }
+    else {
+      SparseVoxels voxels(subdivisionSize, origin);
+      voxels.voxelizeMeshes(getMeshViews(pModel));
+      const uint64_t voxelCount = voxels.getVoxelCount();
+      r.voxelizeSeconds += secondsSince(start);
+      r.voxels += voxelCount;
+      if (!voxelCount) continue;
+
+      start = std::chrono::steady_clock::now();
+      svo.emplace(voxels, 1);
+    }
+    r.octreeSeconds += secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    parent.attach(*svo, origin);
+    r.attachSeconds += secondsSince(start);
+  }
+
+  // Collapsed like vmesh does after attaching so node counts and bytes match its output, timed as part of attaching
+  if (pSubdivisionLevel) {
+    auto start = std::chrono::steady_clock::now();
+    parent.collapse();
+    r.attachSeconds += secondsSince(start);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  r.nodes = parent.generateIndices().size();
+  r.indicesSeconds = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  parent.write(pOut.string());
+  r.writeSeconds = secondsSince(start);
+
+  std::filesystem::path written = pOut;
+  written += ".vm8";
+  r.bytes = std::filesystem::file_size(written);
+  std::filesystem::remove(written);
+
+  if (pLookups) {
+    for (const char* name : {"breadth-first", "depth-first", "blocked"}) {
+      Octree::Layout layout;
+      Octree::parseLayout(name, layout);
+      parent.write(pOut.string(), false, layout);
+      {
+        Vm8View view(written.string());
+        r.layouts.push_back({name, view.measureTraversal(pLookups)});
+      }
+      std::filesystem::remove(written);
+    }
+  }
+  return r;
+}
+
+int main(int argc, char** argv) {
+  std::string meshesStr, methodsStr, resolutionsStr, levelsStr, tmpDirectory, jsonPath;
+  uint repeat, lookups;
+
+  po::options_description visibleOptions("Options", 100, 40);
+  visibleOptions.add_options()
+    ("help,h", "produce help message")
+    ("meshes,m", po::value<std::string>(&meshesStr)->default_value("sphere,terrain,blob"), "comma separated procedural meshes to benchmark (sphere, terrain, blob)")
+    ("methods", po::value<std::string>(&methodsStr)->default_value("dda,tribox,sparse"), "comma separated voxelization methods to benchmark (dda, tribox, sparse)")
+    ("resolutions,R", po::value<std::string>(&resolutionsStr)->default_value("128,256,512"), "comma separated octree resolutions, each has to be a power of 2")
+    ("subdivision-levels,L", po::value<std::string>(&levelsStr)->default_value("0,1,2"), "comma separated subdivision levels, levels deeper than a resolution allows are skipped")
+    ("repeat,r", po::value<uint>(&repeat)->default_value(1), "run each case this many times and keep the fastest time of each stage")
+    ("lookups", po::value<uint>(&lookups)->default_value(100000), "random root to leaf lookups used to measure cache lines touched in each node layout, 0 to skip")
+    ("json", po::value<std::string>(&jsonPath), "also write the results as json to this file")
+    ("tmp-dir", po::value<std::string>(&tmpDirectory)->default_value(std::filesystem::temp_directory_path().string()), "directory for the generated obj files and vm8 output")
+  ;
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(visibleOptions).run(), vm);
+  }
+  catch (boost::wrapexcept<po::invalid_option_value>& pErr) {
+    std::println("{}, use -h for help", pErr.what());
+    return 1;
+  }
+  catch (boost::wrapexcept<po::unknown_option>& pErr) {
+    std::println("{}, use -h for help", pErr.what());
+    return 1;
+  }
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::println("Usage: vmesh-bench OPTIONS\n\nBenchmark voxelization and octree generation on procedural meshes\n");
+    std::cout << visibleOptions;
+    return 0;
+  }
+
+  const std::optional<std::vector<std::string>> meshNames = parseList<std::string>(meshesStr);
+  const std::optional<std::vector<std::string>> methods = parseList<std::string>(methodsStr);
+  const std::optional<std::vector<uint>> resolutions = parseList<uint>(resolutionsStr);
+  const std::optional<std::vector<uint>> levels = parseList<uint>(levelsStr);
+  if (!meshNames || !methods || !resolutions || !levels) {
+    std::println("Invalid list, use -h for help");
+    return 1;
+  }
+  for (const std::string& method : *methods) {
+    if (method != "dda" && method != "tribox" && method != "sparse") {
+      std::println("Invalid method {}, use -h for help", method);
+      return 1;
+    }
+  }
+  for (uint resolution : *resolutions) {
+    if (!resolution || resolution & (resolution - 1)) {
+      std::println("Octree resolution has to be a power of 2");
+      return 1;
+    }
+  }
+  if (!repeat) {
+    std::println("Repeat has to be at least 1");
+    return 1;
+  }
+
+  std::vector<ProceduralMesh> meshes;
+  for (const std::string& name : *meshNames) {
+    auto start = std::chrono::steady_clock::now();
+    if (name == "sphere")       meshes.push_back(generateSphere(5));
+    else if (name == "terrain") meshes.push_back(generateTerrain(257));
+    else if (name == "blob")    meshes.push_back(generateBlob(7));
+    else {
+      std::println("Invalid mesh {}, use -h for help", name);
+      return 1;
+    }
+    std::println("Generated {} with {} triangles in {:.3f}s", name, meshes.back().getTriCount(), secondsSince(start));
+  }
+
+  const std::filesystem::path tmp(tmpDirectory);
+  std::vector<Result> results;
+  for (const ProceduralMesh& mesh : meshes) {
+    const std::filesystem::path objPath = tmp / ("vmesh-bench-" + mesh.name + ".obj");
+    mesh.writeOBJ(objPath.string());
+
+    for (uint resolution : *resolutions) {
+      VMesh::Model model;
+      model.load(objPath.string());
+      fitModel(model, resolution);
+
+      for (uint level : *levels) {
+        if ((1u << level) > resolution) continue;
+        for (const std::string& method : *methods) {
+          Result best;
+          for (uint i = 0; i < repeat; ++i) {
+            Result r = run(model, method, resolution, level, lookups, tmp / "vmesh-bench-out");
+            if (i == 0) best = r;
+            best.voxelizeSeconds = std::min(best.voxelizeSeconds, r.voxelizeSeconds);
+            best.octreeSeconds = std::min(best.octreeSeconds, r.octreeSeconds);
+            best.attachSeconds = std::min(best.attachSeconds, r.attachSeconds);
+            best.indicesSeconds = std::min(best.indicesSeconds, r.indicesSeconds);
+            best.writeSeconds = std::min(best.writeSeconds, r.writeSeconds);
+          }
+          best.mesh = mesh.name;
+          results.push_back(best);
+        }
+      }
+      model.release();
+    }
+    std::filesystem::remove(objPath);
+  }
+
+  // Printed once everything has run so the octree writer's output doesn't break up the table
+  std::println("");
+  std::println("{:<8} {:<7} {:>9} {:>6} {:>2} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>12} {:>10} {:>12}",
+    "mesh", "method", "tris", "res", "L", "voxelize", "octree", "attach", "indices", "write", "total", "voxels", "nodes", "bytes");
+  for (const Result& r : results) {
+    std::println("{:<8} {:<7} {:>9} {:>6} {:>2} {:>10.4f} {:>10.4f} {:>10.4f} {:>10.4f} {:>10.4f} {:>10.4f} {:>12} {:>10} {:>12}",
+      r.mesh, r.method, r.triangles, r.resolution, r.subdivisionLevel, r.voxelizeSeconds, r.octreeSeconds, r.attachSeconds, r.indicesSeconds, r.writeSeconds, r.getTotalSeconds(), r.voxels, r.nodes, r.bytes);
+  }
+
+  // Per lookup averages, misses are against a 32KiB LRU cache shared by every lookup
+  if (lookups) {
+    std::println("");
+    std::println("{:<8} {:<7} {:>6} {:>2} {:<14} {:>8} {:>8} {:>8}", "mesh", "method", "res", "L", "layout", "nodes", "lines", "misses");
+    for (const Result& r : results)
+      for (const LayoutResult& l : r.layouts)
+        std::println("{:<8} {:<7} {:>6} {:>2} {:<14} {:>8.2f} {:>8.2f} {:>8.2f}", r.mesh, r.method, r.resolution, r.subdivisionLevel, l.layout, l.traversal.nodes, l.traversal.lines, l.traversal.misses);
+  }
+
+  if (!jsonPath.empty()) {
+    std::ofstream fout;
+    fout.open(jsonPath, std::ios::out);
+    if (!fout.is_open()) throw std::runtime_error("Could not open json file");
+    fout << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result& r = results[i];
+      std::string layouts;
+      for (const LayoutResult& l : r.layouts)
+        layouts += std::format("{}{{\"layout\": \"{}\", \"nodes\": {}, \"lines\": {}, \"misses\": {}}}", layouts.empty() ? "" : ", ", l.layout, l.traversal.nodes, l.traversal.lines, l.traversal.misses);
+      fout << std::format("  {{\"mesh\": \"{}\", \"method\": \"{}\", \"triangles\": {}, \"resolution\": {}, \"subdivisionLevel\": {}, \"voxelizeSeconds\": {}, \"octreeSeconds\": {}, \"attachSeconds\": {}, \"indicesSeconds\": {}, \"writeSeconds\": {}, \"totalSeconds\": {}, \"voxels\": {}, \"nodes\": {}, \"bytes\": {}, \"layouts\": [{}]}}{}",
+        r.mesh, r.method, r.triangles, r.resolution, r.subdivisionLevel, r.voxelizeSeconds, r.octreeSeconds, r.attachSeconds, r.indicesSeconds, r.writeSeconds, r.getTotalSeconds(), r.voxels, r.nodes, r.bytes, layouts, i + 1 < results.size() ? ",\n" : "\n");
+    }
+    fout << "]\n";
+    fout.close();
+    if (fout.fail()) throw std::runtime_error("Could not write json file");
+  }
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "proceduralMeshes.hpp"
+
+#include <fstream>
+#include <unordered_map>
+#include <stdexcept>
+#include <cmath>
+
+uint ProceduralMesh::getTriCount() const {
+  return indices.size() / 3;
+}
+
+void ProceduralMesh::writeOBJ(const std::string& pPath) const {
+  std::ofstream fout;
+  fout.open(pPath, std::ios::out);
+  if (!fout.is_open()) throw std::runtime_error("Could not open obj file");
+
+  for (const glm::vec3& p : positions) fout << "v " << p.x << ' ' << p.y << ' ' << p.z << '\n';
+  for (uint i = 0; i + 2 < indices.size(); i += 3) fout << "f " << indices[i] + 1 << ' ' << indices[i + 1] + 1 << ' ' << indices[i + 2] + 1 << '\n';
+
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write obj file");
+}
+
+// Unit icosphere around the origin
+static ProceduralMesh generateIcosphere(uint pSubdivisions) {
+  ProceduralMesh mesh;
+  const float t = (1.f + std::sqrt(5.f)) / 2.f;
+  mesh.positions = {
+    {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+    {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+    {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}
+  };
+  mesh.indices = {
+    0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+    1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+    3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+    4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+  };
+  for (glm::vec3& p : mesh.positions) p = p / std::sqrt(glm::dot(p, p));
+
+  // Split every triangle into 4, sharing the midpoint of each edge between the triangles either side of it
+  for (uint s = 0; s < pSubdivisions; ++s) {
+    std::unordered_map<uint64_t, uint> midpoints;
+    auto midpoint = [&](uint pA, uint pB) {
+      const uint64_t key = uint64_t(std::min(pA, pB)) << 32 | std::max(pA, pB);
+      auto [it, isNew] = midpoints.try_emplace(key, mesh.positions.size());
+      if (isNew) {
+        const glm::vec3 p = (mesh.positions[pA] + mesh.positions[pB]) * 0.5f;
+        mesh.positions.push_back(p / std::sqrt(glm::dot(p, p)));
+      }
+      return it->second;
+    };
+
+    std::vector<uint> indices;
+    indices.reserve(mesh.indices.size() * 4);
+    for (uint i = 0; i + 2 < mesh.indices.size(); i += 3) {
+      const uint a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+      const uint ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+      indices.insert(indices.end(), {a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca});
+    }
+    mesh.indices = std::move(indices);
+  }
+  return mesh;
+}
+
+ProceduralMesh generateSphere(uint pSubdivisions) {
+  ProceduralMesh mesh = generateIcosphere(pSubdivisions);
+  mesh.name = "sphere";
+  for (glm::vec3& p : mesh.positions) p = p * 0.5f + 0.5f;
+  return mesh;
+}
+
+ProceduralMesh generateTerrain(uint pSize) {
+  ProceduralMesh mesh;
+  mesh.name = "terrain";
+  mesh.positions.reserve(pSize * pSize);
+  for (uint x = 0; x < pSize; ++x) for (uint z = 0; z < pSize; ++z) {
+    const glm::vec3 p(x / float(pSize - 1), 0, z / float(pSize - 1));
+    mesh.positions.push_back({p.x, fractalNoise(p * 6.f, 6) * 0.5f, p.z});
+  }
+  mesh.indices.reserve((pSize - 1) * (pSize - 1) * 6);
+  for (uint x = 0; x + 1 < pSize; ++x) for (uint z = 0; z + 1 < pSize; ++z) {
+    const uint i = x * pSize + z;
+    mesh.indices.insert(mesh.indices.end(), {i, i + 1, i + pSize,  i + 1, i + pSize + 1, i + pSize});
+  }
+  return mesh;
+}
+
+ProceduralMesh generateBlob(uint pSubdivisions) {
+  ProceduralMesh mesh = generateIcosphere(pSubdivisions);
+  mesh.name = "blob";
+  for (glm::vec3& p : mesh.positions) {
+    const float radius = 0.3f + 0.2f * fractalNoise(p * 2.f + 7.f, 5);
+    p = p * radius + 0.5f;
+  }
+  return mesh;
+}
+
+static float latticeValue(int pX, int pY, int pZ) {
+  uint32_t h = uint32_t(pX) * 374761393u + uint32_t(pY) * 668265263u + uint32_t(pZ) * 2246822519u;
+  h = (h ^ (h >> 13)) * 1274126177u;
+  h ^= h >> 16;
+  return h / float(UINT32_MAX);
+}
+
+static float valueNoise(const glm::vec3& pPos) {
+  const glm::vec3 cell = glm::floor(pPos);
+  const int x = cell.x, y = cell.y, z = cell.z;
+  glm::vec3 f = pPos - cell;
+  f = f * f * (glm::vec3(3.f) - f * 2.f); // Smoothstep so cell borders don't show
+
+  auto lerp = [](float pA, float pB, float pT) { return pA + (pB - pA) * pT; };
+  float xy[2][2];
+  for (int i = 0; i < 2; ++i) for (int j = 0; j < 2; ++j)
+    xy[i][j] = lerp(latticeValue(x + i, y + j, z), latticeValue(x + i, y + j, z + 1), f.z);
+  return lerp(lerp(xy[0][0], xy[0][1], f.y), lerp(xy[1][0], xy[1][1], f.y), f.x);
+}
+
+float fractalNoise(const glm::vec3& pPos, uint pOctaves) {
+  float sum = 0, amplitude = 0.5f, total = 0;
+  glm::vec3 p = pPos;
+  for (uint i = 0; i < pOctaves; ++i) {
+    sum += valueNoise(p) * amplitude;
+    total += amplitude;
+    amplitude *= 0.5f;
+    p = p * 2.f;
+  }
+  return sum / total;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include "glm/glm.hpp"
+
+// Triangle meshes generated in memory so benchmarks don't need any assets, positions are inside the unit cube
+struct ProceduralMesh {
+  std::string name;
+  std::vector<glm::vec3> positions;
+  std::vector<uint> indices;
+
+  uint getTriCount() const;
+  // VMesh models can only be loaded from files so meshes are handed over as obj
+  void writeOBJ(const std::string& pPath) const;
+};
+
+// Icosphere, 20 * 4^subdivisions triangles
+ProceduralMesh generateSphere(uint pSubdivisions);
+// Heightfield of fractal noise on a size x size grid of vertices
+ProceduralMesh generateTerrain(uint pSize);
+// Icosphere with its radius displaced by fractal noise, around 330k triangles at 7 subdivisions
+ProceduralMesh generateBlob(uint pSubdivisions);
+
+// Fractal value noise in the range 0,1
+float fractalNoise(const glm::vec3& pPos, uint pOctaves = 4);
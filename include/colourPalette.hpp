@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <array>
+#include "glm/glm.hpp"
+
+// Normalized rgb colours read from and written to JASC-PAL files, colour i is voxel value i + 1 since 0 is air.
+// Colours are bucketed into a lookup cube so nearest colour queries only check the cells around the colour.
+class ColourPalette {
+public:
+  static constexpr uint LOOKUP_CELLS = 16; // Per channel
+
+  ColourPalette() = default;
+  ColourPalette(const std::vector<glm::vec3>& pColours);
+
+  uint findNearest(const glm::vec3& pColour) const;
+  // Returns the index of a colour within sqrt(pDistance2), adding this colour if there isn't one
+  uint addColour(const glm::vec3& pColour, float pDistance2);
+
+  void readFromFile(const std::string& pPath);
+  void writeToFile(const std::string& pPath) const;
+
+  uint size() const;
+  const glm::vec3& getColour(uint pIndex) const;
+  const std::vector<glm::vec3>& getColours() const;
+
+  // Reduces weighted colours to at most pMaxColours by repeatedly splitting the box with the widest channel at its
+  // weighted median, each box becomes the weighted average of its colours. Colours with no weight are ignored.
+  static ColourPalette medianCut(const std::vector<glm::vec3>& pColours, const std::vector<uint64_t>& pWeights, uint pMaxColours);
+
+private:
+  static uint toCell(const glm::uvec3& pCellPos);
+  static glm::uvec3 toCellPos(const glm::vec3& pColour);
+
+  std::vector<glm::vec3> mColours;
+  std::array<std::vector<uint>, LOOKUP_CELLS * LOOKUP_CELLS * LOOKUP_CELLS> mCells;
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Compact vm8 nodes used by versions 102 and 103, see vm8-file-format.md. A node is a 16 bit field of 2 bit child kinds
+// followed by its non air children, palette leaves are a byte and child nodes are a 16 or 32 bit offset in bytes from
+// the start of their parent.
+enum class ChildKind : uint8_t {
+  Air = 0,
+  Leaf = 1,
+  Node16 = 2,
+  Node32 = 3
+};
+
+// pIndices are vm8 records like Octree::generateIndices makes, children have to come after their parent
+std::vector<uint8_t> encodeCompactIndices(const std::vector<std::array<uint32_t, 8>>& pIndices, uint32_t pPaletteSize);
+// Back to vm8 records, pNodeCount is the number of nodes in pData
+std::vector<std::array<uint32_t, 8>> decodeCompactIndices(const uint8_t* pData, size_t pSize, uint32_t pNodeCount, uint32_t pPaletteSize);
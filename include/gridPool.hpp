@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "VMesh/voxelGrid.hpp"
+
+// Voxel grids kept between batch jobs so jobs voxelizing at the same resolution don't reallocate them
+class GridPool {
+public:
+  // A cleared grid from the pool, or a new one when there's no pool, given back when it goes out of scope
+  class Lease {
+  public:
+    Lease(GridPool* pPool, uint pResolution);
+    ~Lease();
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    VMesh::VoxelGrid& operator*() { return *mGrid; }
+    VMesh::VoxelGrid* operator->() { return mGrid.get(); }
+
+  private:
+    GridPool* mPool;
+    std::unique_ptr<VMesh::VoxelGrid> mGrid;
+  };
+
+  // Idle grids are kept while they take at most pMaxBytes
+  GridPool(uint64_t pMaxBytes);
+
+  // A pooled grid of pResolution reset to how a new one starts, otherwise a new one is allocated after freeing the least
+  // recently returned idle grids it wouldn't fit in the budget alongside
+  std::unique_ptr<VMesh::VoxelGrid> acquire(uint pResolution);
+  // The least recently returned grids are freed while the idle ones are over budget
+  void release(std::unique_ptr<VMesh::VoxelGrid> pGrid);
+
+  static uint64_t getGridBytes(uint pResolution);
+
+private:
+  std::mutex mMutex;
+  uint64_t mMaxBytes, mIdleBytes = 0;
+  std::vector<std::unique_ptr<VMesh::VoxelGrid>> mGrids; // Most recently returned last
+};
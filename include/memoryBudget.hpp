@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <cstdint>
+#include "meshCache.hpp"
+#include "sparseVoxels.hpp"
+
+// Rough peak memory of generating an octree or 64tree from a mesh, split into what's paid once and what each job
+// pays for the subdivision it's working on. Nodes and sparse bricks follow the surface, so surface voxels are
+// estimated from the area of the triangles in voxel space.
+class MemoryBudget {
+public:
+  // VMesh grids give a uint per voxel, assumed to be stored as one
+  static constexpr uint64_t GRID_BYTES_PER_VOXEL = sizeof(uint32_t);
+  static constexpr uint64_t PALETTE_BYTES = 256 * sizeof(glm::vec3);
+  static constexpr uint64_t NODE_BYTES = 8 * sizeof(uint32_t);
+  // Bricks are appended before they're merged so the list can be twice the merged size
+  static constexpr uint64_t BRICK_BYTES = 2 * sizeof(Brick);
+  // A surface voxelized without gaps is up to about root 3 voxels thick
+  static constexpr double SURFACE_VOXELS_PER_AREA = 1.75;
+  // A plane fills about 4 children of each node it crosses and each level up has a quarter of the nodes
+  static constexpr double SURFACE_VOXELS_PER_NODE = 3;
+  // A plane crossing a 4x4x4 brick fills 16 of its voxels, less where it only clips a corner
+  static constexpr double SURFACE_VOXELS_PER_BRICK = 8;
+
+  MemoryBudget(uint64_t pMaxBytes, uint pResolution, std::span<const MeshView> pMeshes, bool pIsSparse, bool pIsSpilled);
+
+  // The mesh, triangle bins and the octree kept until it's written
+  uint64_t getSharedBytes(uint pSubdivisionLevel) const;
+  // A grid and its palette or sparse bricks, and the subtree built from them
+  uint64_t getJobBytes(uint pSubdivisionLevel) const;
+  uint64_t estimate(uint pSubdivisionLevel, uint pJobs) const;
+
+  // Lowest level from pMinLevel to pMaxLevel in steps of pLevelStep that fits with pMinJobs jobs, then the most jobs up
+  // to pMaxJobs that still fit, pJobs is never below pMinJobs. When no level fits it picks the one with the smallest
+  // estimate and returns false.
+  bool plan(uint pMinLevel, uint pMaxLevel, uint pLevelStep, uint pMinJobs, uint pMaxJobs, uint& pSubdivisionLevel, uint& pJobs) const;
+
+  // Bytes each job's sparse bricks can grow to before its subdivision is split
+  uint64_t getSparseBudget(uint pSubdivisionLevel, uint pJobs) const;
+
+  uint64_t getMaxBytes() const;
+  uint64_t getSurfaceVoxels() const;
+
+  // Sizes like 512M or 8G, suffixes are powers of 1024
+  static bool parseBytes(const std::string& pStr, uint64_t& pBytes);
+
+private:
+  // Surface voxels in one subdivision, a surface crosses about 4^level of the 8^level subdivisions
+  double getSubdivisionVoxels(uint pSubdivisionLevel) const;
+
+  uint64_t mMaxBytes;
+  uint mResolution;
+  bool mIsSparse, mIsSpilled;
+  uint64_t mTriangles = 0, mMeshBytes = 0;
+  uint64_t mSurfaceVoxels;
+};
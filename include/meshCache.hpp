@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <span>
+#include <cstdint>
+#include "glm/glm.hpp"
+#include "VMesh/model.hpp"
+
+// Positions and triangle indices of one mesh. Positions are strided so a view can point straight into VMesh vertices
+// as well as into a mesh cache.
+struct MeshView {
+  const uint8_t* positions;
+  size_t stride;
+  const uint32_t* indices;
+  uint64_t indexCount;
+
+  const glm::vec3& getPosition(uint32_t pIndex) const {
+    return *reinterpret_cast<const glm::vec3*>(positions + pIndex * stride);
+  }
+};
+
+// Views of every mesh of a loaded model, they're invalidated when the model is released
+std::vector<MeshView> getMeshViews(VMesh::Model& pModel);
+// Smallest and largest position of every vertex a triangle uses
+void getMeshBounds(std::span<const MeshView> pMeshes, glm::vec3& pSmallest, glm::vec3& pLargest);
+// Moves the bounds to the origin and scales them to fit a pResolution grid, pScaleMode is proportional, stretch or none
+glm::mat4 getFitMatrix(const glm::vec3& pSmallest, const glm::vec3& pLargest, uint pResolution, const std::string& pScaleMode);
+
+// Flat file of a model's untransformed positions, indices and bounds that gets memory mapped so repeat runs don't have
+// to load the model through assimp. It's keyed by the model's path, modification time and size.
+class MeshCache {
+public:
+  static constexpr char MAGIC[4] = {'V', 'M', 'M', 'C'};
+  static constexpr uint32_t VERSION = 1;
+
+  MeshCache() = default;
+  MeshCache(const MeshCache&) = delete;
+  MeshCache& operator=(const MeshCache&) = delete;
+  ~MeshCache();
+
+  // File in pDirectory that caches pModelPath
+  static std::string getPath(const std::string& pDirectory, const std::string& pModelPath);
+  static void write(const std::string& pPath, const std::string& pModelPath, std::span<const MeshView> pMeshes, const glm::vec3& pSmallest, const glm::vec3& pLargest);
+
+  // Maps pPath, returns false when it's missing, isn't a mesh cache or was made from a different version of pModelPath
+  bool open(const std::string& pPath, const std::string& pModelPath);
+
+  // Positions are mapped copy on write so transforming them never touches the file
+  void transform(const glm::mat4& pMatrix);
+
+  std::vector<MeshView> getMeshViews() const;
+  uint getNumMeshes() const;
+  uint64_t getTriCount() const;
+  const glm::vec3& getSmallest() const;
+  const glm::vec3& getLargest() const;
+
+private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t modelSize;
+    int64_t modelModified; // Nanoseconds since the file clock's epoch
+    uint32_t pathSize;     // The model's absolute path follows the header, padded to 8 bytes
+    uint32_t meshCount;    // Then a vertex and index count per mesh, then every mesh's positions then indices
+    glm::vec3 smallest, largest;
+  };
+
+  // Key that has to match for a cache to be used
+  static bool getModelKey(const std::string& pModelPath, std::string& pAbsolutePath, uint64_t& pSize, int64_t& pModified);
+  static uint64_t getPathSize(uint32_t pSize);
+
+  void close();
+
+  void* mData = nullptr;
+  size_t mSize = 0;
+  glm::vec3 mSmallest, mLargest;
+  std::vector<glm::vec3*> mPositions;
+  std::vector<const uint32_t*> mIndices;
+  std::vector<uint64_t> mVertexCounts, mIndexCounts;
+};
@@ -4,37 +4,83 @@
 #include <vector>
 #include <array>
 #include <limits>
-#include <memory>
+#include <bit>
+#include <unordered_map>
+#include <fstream>
+#include <atomic>
+#include <span>
 #include "VMesh/voxelGrid.hpp"
-
-struct Node {
-  Node() = default;
-  Node(uint32_t i) : index(i) {};
-  uint32_t index = 0;
-  std::array<std::shared_ptr<Node>, 8> children;
-};
+#include "sparseVoxels.hpp"
 
 class Octree {
 public:
+  // Children are 32 bit handles, either an index into mNodes or a palette index with LEAF_BIT set
+  static constexpr uint32_t LEAF_BIT = 1u << 31;
+  static constexpr uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+  static constexpr size_t WRITE_BUFFER_NODES = 1 << 16;
+  // Blocks built between updates of the shared progress counter
+  static constexpr uint64_t PROGRESS_BATCH = 4096;
+  // 64 regions so jobs stay busy when some octants are empty
+  static constexpr uint PARALLEL_SPLIT_DEPTH = 2;
+  // Levels stored together by Layout::Blocked, a full block is 585 nodes
+  static constexpr uint LAYOUT_BLOCK_DEPTH = 4;
+
+  // Order nodes are numbered in when written, every layout keeps children after their parent
+  enum class Layout {
+    BreadthFirst,
+    DepthFirst, // Pre order, a node's first child directly follows it
+    Blocked // Breadth first within blocks of LAYOUT_BLOCK_DEPTH levels, blocks depth first
+  };
+
   Octree(uint pResolution, uint pPaletteSize);
-  Octree(VMesh::VoxelGrid& pGrid, uint64_t* pCompletedCount = NULL);
+  // With more than one job the octants PARALLEL_SPLIT_DEPTH levels down are built in parallel and linked under the root
+  Octree(VMesh::VoxelGrid& pGrid, std::atomic<uint64_t>* pCompletedCount = NULL, uint pJobs = 1);
+  Octree(SparseVoxels& pVoxels, uint pPaletteSize); // Solid voxels are palette index 1
+  Octree(std::span<const uint8_t> pVoxels, uint pResolution, uint pPaletteSize); // Palette indices of a cube in morton order
 
   void attach(Octree& pOctree, glm::uvec3& pOrigin);
+  // Half resolution copy for LODs, each 2x2x2 block becomes the most common colour among its solid voxels
+  Octree downsample();
+  // Voxels of each palette index, index 0 is air
+  std::vector<uint64_t> getPaletteHistogram();
+  // Replaces each palette index i with pMap[i] and merges subtrees that become uniform
+  void remapPalette(const std::vector<uint32_t>& pMap, uint pPaletteSize);
+  // Merges nodes whose children are all the same leaf, bottom up so whole uniform subtrees become one leaf. Attached
+  // subtrees are only merged within themselves, this makes the tree the same as one built in a single pass.
+  // Returns the number of reachable nodes merged away, nodes left unreachable by attach are freed but not counted.
+  uint collapse();
 
-  std::vector<std::array<uint32_t, 8>> generateIndices();
+  // Handles of the nodes reachable from the root in the order they're numbered
+  std::vector<uint32_t> getNodeOrder(Layout pLayout);
+  std::vector<std::array<uint32_t, 8>> generateIndices(Layout pLayout = Layout::BreadthFirst);
+  static uint deduplicateIndices(std::vector<std::array<uint32_t, 8>>& pIndices);
+  uint32_t writeIndices(std::ofstream& pOut, uint32_t pPaletteStart, Layout pLayout = Layout::BreadthFirst);
 
   void resizePalette(uint pSize);
 
   uint getResolution();
+  uint getNodeCount();
 
-  void write(std::string pPath);
+  // Compact files are version 102, or 103 for a DAG
+  void write(std::string pPath, bool pIsDAG = false, Layout pLayout = Layout::BreadthFirst, bool pIsCompact = false);
+
+  static bool parseLayout(const std::string& pStr, Layout& pLayout);
 
-  void generateNode();
-  void processNode(std::shared_ptr<Node> pNode, std::vector<std::array<uint32_t*, 8>>& pArangement, std::vector<std::shared_ptr<Node>>& pQueue);
   static uint toChildIndex(const glm::uvec3& pPos);
   static glm::uvec3 toChildPos(uint8_t pIndex);
+  static uint64_t toMorton(const glm::uvec3& pPos);
+  static glm::uvec3 fromMorton(uint64_t pCode);
+
+  static bool isLeaf(uint32_t pHandle) { return pHandle & LEAF_BIT; }
+  static uint32_t toLeaf(uint pPaletteIndex) { return pPaletteIndex | LEAF_BIT; }
 
   uint mResolution;
-  std::vector<std::shared_ptr<Node>> mNodes;
-  std::vector<std::shared_ptr<Node>> mPalette;
+  uint mPaletteSize;
+  uint32_t mRoot = LEAF_BIT;
+  std::vector<std::array<uint32_t, 8>> mNodes;
+
+private:
+  // Builds a pResolution cube bottom up into pNodes from every 2x2x2 block in morton order, pBlock(i, voxels) gives the
+  // leaves of the ith block. Returns the handle of the cube.
+  template<class F> static uint32_t buildDense(uint pResolution, F&& pBlock, std::vector<std::array<uint32_t, 8>>& pNodes, std::atomic<uint64_t>* pCompletedCount);
 };
@@ -1,15 +1,58 @@
 #pragma once
 
 #include <print>
-#include <future>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <chrono>
 #include <cmath>
 #include <iostream>
 
-void printProgressBar(const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, float pTotalInv, std::mutex* pSTDOUTMutex, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
+// Redraws a progress bar from a background thread that sleeps between redraws, wait wakes it up to print the final state.
+// An inactive (default constructed) bar does nothing.
+class ProgressBar {
+public:
+  ProgressBar() = default;
+  ProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, std::function<uint64_t()> pRead, uint64_t pTotal, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
+  ProgressBar(ProgressBar&& pOther) = default;
+  ProgressBar& operator=(ProgressBar&& pOther);
+  ~ProgressBar();
 
-void printProgressBarUntilDone(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
+  bool valid() const;
+  // Call once the work is done, prints the final state and stops the thread
+  void wait();
 
-std::future<void> startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
+private:
+  struct State {
+    std::mutex* stdoutMutex;
+    std::string title;
+    std::function<uint64_t()> read;
+    uint64_t total;
+    uint8_t primaryEscapeColour, secondaryEscapeColour;
+    uint width;
 
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool isDone = false;
+  };
+
+  static void print(State& pState);
+  static void run(State& pState);
+
+  std::unique_ptr<State> mState;
+  std::thread mThread;
+};
+
+// Progress bars are drawn with carriage returns so they're turned off when output isn't a terminal
+void setProgressBarsEnabled(bool pIsEnabled);
+bool areProgressBarsEnabled();
+
+ProgressBar startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, const std::atomic<uint64_t>* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
+
+// For VMesh's counters, which it increments as plain integers. They're only ever read through relaxed std::atomic_ref
+// loads so a redraw sees a whole, possibly slightly old, count and never a torn one.
+ProgressBar startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
+ProgressBar startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour = 31, uint8_t pSecondaryEscapeColour = 30, uint pWidth = 20);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include "triangleBins.hpp"
+
+// 4x4x4 bricks of binary voxels, mask bit i is the voxel at morton index i in the brick
+struct Brick {
+  uint64_t code; // Morton code of the brick, the morton code of its first voxel >> 6
+  uint64_t mask;
+};
+
+// Binary voxels of a cubic region kept as bricks sorted by morton code, filled by rasterizing triangles directly
+// rather than through a dense VoxelGrid so memory scales with the surface rather than the volume.
+class SparseVoxels {
+public:
+  SparseVoxels(uint pResolution, const glm::uvec3& pOrigin = glm::uvec3(0));
+
+  void voxelizeTriangle(const glm::vec3& pA, const glm::vec3& pB, const glm::vec3& pC);
+  // Both return false when they stop early because the bricks grew past the max bytes
+  bool voxelizeMeshes(std::span<const MeshView> pMeshes, std::atomic<uint64_t>* pTrisComplete = NULL);
+  bool voxelizeTriangles(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, std::atomic<uint64_t>* pTrisComplete = NULL);
+
+  // 0 is no limit
+  void setMaxBytes(uint64_t pMaxBytes);
+  uint64_t getBytes() const;
+
+  // Sorts bricks and merges duplicates, called automatically as bricks are added
+  void compact();
+
+  const std::vector<Brick>& getBricks();
+  uint getResolution() const;
+  uint64_t getVoxelCount();
+
+  static bool triangleBoxOverlap(const glm::vec3& pCenter, float pHalfSize, const glm::vec3& pA, const glm::vec3& pB, const glm::vec3& pC);
+
+private:
+  // Triangles voxelized between updates of the shared progress counter
+  static constexpr uint64_t PROGRESS_BATCH = 256;
+
+  void addVoxel(const glm::uvec3& pPos);
+
+  uint mResolution;
+  glm::uvec3 mOrigin;
+  std::vector<Brick> mBricks;
+  size_t mCompactedSize = 0;
+  uint64_t mMaxBytes = 0;
+};
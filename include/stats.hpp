@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <format>
+#include <algorithm>
+#include <filesystem>
+
+// Timings and sizes of a run, written as json with --stats-json.
+// Phase cpu time is for the whole process so it covers every job, subdivision cpu time is for the job's thread.
+class Stats {
+public:
+  struct Phase {
+    std::string name;
+    double wallSeconds, cpuSeconds;
+  };
+
+  struct Subdivision {
+    uint index;
+    double voxelizationWallSeconds, voxelizationCpuSeconds;
+    double generationWallSeconds, generationCpuSeconds;
+    uint64_t triangles, voxels, nodes;
+    bool isCached; // Read from the subtree cache rather than voxelized
+  };
+
+  // Records a phase from construction until end is called or it goes out of scope, it's also a trace zone
+  class Scope {
+  public:
+    Scope(Stats& pStats, const char* pName);
+    ~Scope();
+
+    void end();
+
+  private:
+    Stats* mStats;
+    const char* mName;
+    std::chrono::steady_clock::time_point mStart;
+    double mCpuStart;
+  };
+
+  Stats();
+
+  // Both are safe to call from multiple jobs
+  void addPhase(const Phase& pPhase);
+  void addSubdivision(const Subdivision& pSubdivision);
+
+  void write(const std::string& pPath);
+
+  static double getProcessCpuTime();
+  static double getThreadCpuTime();
+  static uint64_t getPeakRSS();
+  // Size of the first of the paths that exists, 0 if none do
+  static uint64_t getFileSize(std::initializer_list<std::filesystem::path> pPaths);
+
+  std::string mInput, mOutputFormat;
+  uint mResolution = 0, mSubdivisionLevel = 0, mJobs = 1;
+  uint64_t mTriangles = 0, mVoxels = 0, mNodes = 0, mCollapsedNodes = 0, mCachedSubdivisions = 0, mSplits = 0, mPaletteSize = 0, mBytesWritten = 0;
+
+private:
+  std::mutex mMutex;
+  std::vector<Phase> mPhases;
+  std::vector<Subdivision> mSubdivisions;
+  std::chrono::steady_clock::time_point mStart;
+  double mCpuStart;
+};
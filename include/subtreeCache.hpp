@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <span>
+#include "octree.hpp"
+#include "meshCache.hpp"
+
+// Finished subdivision octrees kept between runs, keyed by a hash of the voxel space positions of the triangles binned
+// to the subdivision and the parameters that decide what they voxelize to. A rebake after editing part of a mesh only
+// voxelizes the subdivisions whose triangles changed, the rest are read back from here.
+class SubtreeCache {
+public:
+  static constexpr char MAGIC[4] = {'V', 'M', 'S', 'T'};
+  static constexpr uint32_t VERSION = 1;
+
+  SubtreeCache(const std::filesystem::path& pDirectory);
+
+  // Positions are hashed after the model is transformed so the scale and translation are part of the key
+  static uint64_t hashTriangles(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, uint64_t pSeed);
+  static uint64_t hashTriangles(std::span<const MeshView> pMeshes, uint64_t pSeed);
+  static uint64_t hashValues(std::initializer_list<uint64_t> pValues, uint64_t pSeed = 0);
+
+  // Both are safe to call from multiple jobs. Load returns false when pKey isn't cached or its file is unreadable,
+  // truncated or doesn't hold a valid tree. An empty subdivision is cached as a single air leaf with pVoxelCount 0.
+  bool load(uint64_t pKey, Octree& pOctree, uint64_t& pVoxelCount);
+  void store(uint64_t pKey, const Octree& pOctree, uint64_t pVoxelCount);
+
+private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t resolution;
+    uint32_t root;
+    uint64_t voxelCount;
+    uint64_t nodeCount; // Then the octree's nodes as they are in memory
+  };
+
+  std::filesystem::path getPath(uint64_t pKey) const;
+
+  std::filesystem::path mDirectory;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <atomic>
+#include "octree.hpp"
+
+// Keeps finished subdivision octrees in temporary files rather than memory, write then stitches them under the top
+// levels of the octree while streaming them into the final .vm8. Subtrees are read back a level at a time so the file
+// is numbered breadth first like an attached octree's, only the top levels and a read buffer are in memory while merging.
+class SubtreeSpill {
+public:
+  SubtreeSpill(const std::filesystem::path& pDirectory, uint pResolution, uint pSubdivisionSize);
+  ~SubtreeSpill();
+
+  // Safe to call from multiple jobs as long as they add different subdivisions
+  void add(uint pSubdivision, Octree& pOctree);
+  // Replaces each of a spilled subdivision's palette indices i with pMap[i] like Octree::remapPalette. Maps that keep
+  // colours apart are applied while merging, ones that merge colours read the subtree back to collapse it.
+  void remapPalette(uint pSubdivision, const std::vector<uint32_t>& pMap, uint pPaletteSize);
+
+  // Returns the number of top level nodes merged because their children were all the same leaf
+  uint write(std::string pPath, uint pPaletteSize);
+
+  uint64_t getSpilledBytes() const;
+
+  static constexpr uint32_t SUBTREE_BIT = 1u << 30; // Marks a top level child that is a spilled subtree
+  static constexpr size_t READ_BUFFER_NODES = 1 << 16;
+
+private:
+  std::filesystem::path getSpillPath(uint pSubdivision) const;
+
+  // Spill files are named by pid and instance so batch jobs sharing a directory don't collide
+  static inline std::atomic<uint> mNextInstance = 0;
+
+  std::filesystem::path mDirectory;
+  uint mInstance;
+  uint mResolution, mSubdivisionSize, mSubdimensions;
+  std::vector<uint32_t> mRoots; // Leaf handle, or SUBTREE_BIT if the subtree was spilled
+  std::vector<uint32_t> mNodeCounts;
+  std::vector<std::vector<uint32_t>> mLevelCounts; // Nodes in each breadth first level of a spilled subtree
+  std::vector<std::vector<uint32_t>> mPaletteMaps; // Applied to a spilled subtree's leaves while merging, empty for none
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Chrome trace_event zones written with --trace, open the output in chrome://tracing or ui.perfetto.dev.
+// Zones compile away without _PROFILING and only cost a relaxed load until startTrace is called.
+
+inline std::atomic<bool> isTraceEnabled = false;
+
+struct TraceEvent {
+  const char* name; // Has to be a string literal, it's kept until the trace is written
+  int64_t index;    // Shown as an arg when it isn't negative
+  std::chrono::steady_clock::time_point begin, end;
+};
+
+void startTrace();
+// Each thread gets its own track, named "thread n" unless this is called on it
+void setTraceThreadName(const std::string& pName);
+void addTraceEvent(const TraceEvent& pEvent);
+// Call once every thread has finished adding events
+void writeTrace(const std::string& pPath);
+
+class TraceScope {
+public:
+  TraceScope(const char* pName, int64_t pIndex = -1)
+  :mName(isTraceEnabled.load(std::memory_order_relaxed) ? pName : nullptr), mIndex(pIndex) {
+    if (mName) mBegin = std::chrono::steady_clock::now();
+  }
+
+  ~TraceScope() {
+    if (mName) addTraceEvent({mName, mIndex, mBegin, std::chrono::steady_clock::now()});
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* mName;
+  int64_t mIndex;
+  std::chrono::steady_clock::time_point mBegin;
+};
+
+#define TRACE_CONCAT_IMPL(pA, pB) pA##pB
+#define TRACE_CONCAT(pA, pB) TRACE_CONCAT_IMPL(pA, pB)
+
+#ifdef _PROFILING
+  #define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+#else
+  #define TRACE_SCOPE(...)
+#endif
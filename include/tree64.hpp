@@ -0,0 +1,57 @@
+#pragma once
+
+#include <print>
+#include <vector>
+#include <array>
+#include <limits>
+#include <bit>
+#include <fstream>
+#include <atomic>
+#include "VMesh/voxelGrid.hpp"
+
+// Air children aren't stored, mChildren[first + popcount of the mask below a child] is the handle of a present child
+struct Node64 {
+  uint64_t mask = 0;
+  uint32_t first = 0;
+};
+
+class Tree64 {
+public:
+  // Children are 32 bit handles, either an index into mNodes or a palette index with LEAF_BIT set
+  static constexpr uint32_t LEAF_BIT = 1u << 31;
+  static constexpr uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+  static constexpr size_t WRITE_BUFFER_WORDS = 1 << 20;
+  // Blocks built between updates of the shared progress counter
+  static constexpr uint64_t PROGRESS_BATCH = 4096;
+
+  Tree64(uint pResolution, uint pPaletteSize);
+  Tree64(VMesh::VoxelGrid& pGrid, std::atomic<uint64_t>* pCompletedCount = NULL);
+
+  void attach(Tree64& pTree, glm::uvec3& pOrigin);
+  // Replaces each palette index i with pMap[i], nodes that become uniform are left as they are
+  void remapPalette(const std::vector<uint32_t>& pMap, uint pPaletteSize);
+
+  uint32_t getChild(uint32_t pNode, uint pChildIndex);
+  void setChild(uint32_t pNode, uint pChildIndex, uint32_t pHandle);
+
+  uint64_t writeWords(std::ofstream& pOut);
+
+  void resizePalette(uint pSize);
+
+  uint getResolution();
+  uint getNodeCount();
+
+  void write(std::string pPath);
+
+  static uint toChildIndex(const glm::uvec3& pPos);
+  static glm::uvec3 toChildPos(uint8_t pIndex);
+
+  static bool isLeaf(uint32_t pHandle) { return pHandle & LEAF_BIT; }
+  static uint32_t toLeaf(uint pPaletteIndex) { return pPaletteIndex | LEAF_BIT; }
+
+  uint mResolution;
+  uint mPaletteSize;
+  uint32_t mRoot = LEAF_BIT;
+  std::vector<Node64> mNodes;
+  std::vector<uint32_t> mChildren;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include "meshCache.hpp"
+
+struct TriangleRef {
+  uint32_t mesh;
+  uint32_t index; // Index of the triangles first vertex index in the meshes indices
+};
+
+// Triangles of a model sorted into the cells of a grid of subdivisions by their bounding boxes, stored as one array
+// of refs with an offset per cell. The meshes have to already be transformed into voxel space.
+class TriangleBins {
+public:
+  TriangleBins(std::span<const MeshView> pMeshes, uint pSubdivisionSize, uint pSubdimensions);
+  // Bins only pTriangles into a grid of cells starting at pOrigin, for splitting a subdivision into smaller ones
+  TriangleBins(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, const glm::uvec3& pOrigin, uint pSubdivisionSize, uint pSubdimensions);
+
+  std::span<const TriangleRef> getTriangles(uint pCell) const;
+  uint getTriCount(uint pCell) const;
+  uint getCellCount() const;
+  uint getEmptyCellCount() const;
+
+  uint toCell(const glm::uvec3& pCellPos) const;
+
+private:
+  // pForEach(pFunc) calls pFunc with every triangle to bin
+  template<class F> void bin(std::span<const MeshView> pMeshes, const glm::uvec3& pOrigin, F&& pForEach);
+
+  uint mSubdivisionSize, mSubdimensions;
+  std::vector<uint64_t> mOffsets;
+  std::vector<TriangleRef> mTriangles;
+};
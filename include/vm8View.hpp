@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include "VMesh/voxelGrid.hpp"
+
+// Read only view of a .vm8 file mapped into memory, nothing is copied out of the file so it can be opened instantly
+// regardless of size. Compact files are the exception, they're decoded into memory when opened. Values returned are
+// palette indices where 0 is air.
+class Vm8View {
+public:
+  // Averages per lookup
+  struct TraversalStats {
+    double nodes;
+    double lines; // Distinct cache lines of the index array
+    double misses; // Lines that weren't in the simulated cache
+  };
+
+  Vm8View(const std::string& pPath);
+  ~Vm8View();
+
+  Vm8View(const Vm8View&) = delete;
+  Vm8View& operator=(const Vm8View&) = delete;
+
+  uint lookup(const glm::uvec3& pPos) const;
+  void lookup(const std::vector<glm::uvec3>& pPositions, std::vector<uint>& pValues) const;
+
+  // Calls pCallback for every uniform cube of the octree that overlaps the box [pMin, pMax), cubes aren't clipped to the box
+  void iterateRegion(const glm::uvec3& pMin, const glm::uvec3& pMax, const std::function<void(const glm::uvec3& pOrigin, uint pSize, uint pValue)>& pCallback) const;
+
+  // Walks pLookups random paths from the root to a leaf, taking a random child node at each level like a lookup of a
+  // random surface voxel would. Lines are 64 bytes from the start of the indices and the cache is LRU shared by every lookup.
+  TraversalStats measureTraversal(uint pLookups, uint pCacheLines = 512, uint pSeed = 0) const;
+
+  uint getResolution() const;
+  uint getPaletteSize() const;
+  uint getVersion() const;
+  bool isCompact() const;
+  uint32_t getNodeCount() const;
+
+  static constexpr size_t HEADER_SIZE = 6 + 4 * 4;
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+
+private:
+  // The one voxel of a resolution 1 octree, LODs go down to it
+  uint getSingleVoxel() const;
+
+  uint32_t child(uint32_t pNode, uint pChildIndex) const {
+    uint32_t c;
+    std::memcpy(&c, mIndices + (size_t(pNode) * 8 + pChildIndex) * sizeof(uint32_t), sizeof(uint32_t));
+    return c;
+  }
+
+  int mFile = -1;
+  void* mData = nullptr;
+  size_t mSize = 0;
+  const char* mIndices = nullptr;
+  std::vector<std::array<uint32_t, 8>> mDecoded;
+
+  uint32_t mVersion, mResolution, mPaletteSize, mNodeCount, mAirIndex;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <functional>
+#include "glm/glm.hpp"
+#include "colourPalette.hpp"
+
+// Reads the first model of a MagicaVoxel file, its voxels are streamed from the XYZI chunk rather than loaded into a grid.
+// A voxel's value is its VOX colour index which is palette colour value - 1, 0 being air like everywhere else.
+class VoxReader {
+public:
+  static constexpr size_t READ_BUFFER_VOXELS = 1 << 16;
+
+  VoxReader(const std::string& pPath);
+
+  // Calls pCallback for every voxel in file order
+  void readVoxels(const std::function<void(const glm::uvec3& pPos, uint8_t pIndex)>& pCallback);
+
+  const glm::uvec3& getSize() const;
+  uint64_t getVoxelCount() const;
+  bool hasPalette() const; // Files without an RGBA chunk use MagicaVoxel's default palette
+  const ColourPalette& getPalette() const;
+
+private:
+  std::ifstream mFin;
+  glm::uvec3 mSize;
+  std::streamoff mVoxelsOffset = -1;
+  uint64_t mVoxelCount = 0;
+  ColourPalette mPalette;
+  bool mHasPalette = false;
+};
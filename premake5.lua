@@ -66,3 +66,81 @@ project "VMesh-cli"
         "VMesh"
     }
 
+
+project "vmesh-bench"
+    kind "ConsoleApp"
+    language "C++"
+    targetname "vmesh-bench"
+    targetdir ("bin/" .. outputdir)
+    objdir ("bin-int/" .. outputdir .. "/bench")
+
+    files {
+        "bench/**.hpp",
+        "bench/**.cpp",
+        "src/**.cpp",
+        "include/**.hpp",
+        "dependencies/src/**.cpp",
+        "dependencies/src/**.c",
+        "dependencies/include/**.h",
+        "dependencies/include/**.hpp"
+    }
+
+    removefiles {
+        "src/main.cpp"
+    }
+
+    includedirs {
+        "include",
+        "bench",
+        "dependencies/include",
+        "/usr/include"
+    }
+
+    libdirs {
+        "dependencies/libs"
+    }
+
+    links {
+        "boost_program_options",
+        "assimp",
+        "VMesh"
+    }
+
+
+project "vmesh-test"
+    kind "ConsoleApp"
+    language "C++"
+    targetname "vmesh-test"
+    targetdir ("bin/" .. outputdir)
+    objdir ("bin-int/" .. outputdir .. "/test")
+    dependson {"VMesh-cli"} -- Some tests run the vmesh binary next to this one
+
+    files {
+        "test/**.cpp",
+        "src/**.cpp",
+        "include/**.hpp",
+        "dependencies/src/**.cpp",
+        "dependencies/src/**.c",
+        "dependencies/include/**.h",
+        "dependencies/include/**.hpp"
+    }
+
+    removefiles {
+        "src/main.cpp"
+    }
+
+    includedirs {
+        "include",
+        "dependencies/include",
+        "/usr/include"
+    }
+
+    libdirs {
+        "dependencies/libs"
+    }
+
+    links {
+        "boost_program_options",
+        "assimp",
+        "VMesh"
+    }
@@ -0,0 +1,165 @@
+#include "colourPalette.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+ColourPalette::ColourPalette(const std::vector<glm::vec3>& pColours) {
+  for (const glm::vec3& c : pColours) addColour(c, -1);
+}
+
+uint ColourPalette::findNearest(const glm::vec3& pColour) const {
+  if (mColours.empty()) throw std::runtime_error("Palette is empty");
+
+  const glm::uvec3 center = toCellPos(pColour);
+  const float cellSize = 1.f / LOOKUP_CELLS;
+  uint best = 0;
+  float bestDistance2 = std::numeric_limits<float>::infinity();
+
+  // Check shells of cells further and further out, anything past shell r is at least r cells away
+  for (int r = 0; r < int(LOOKUP_CELLS); ++r) {
+    glm::ivec3 lo, hi;
+    for (uint i = 0; i < 3; ++i) {
+      lo[i] = std::max(int(center[i]) - r, 0);
+      hi[i] = std::min(int(center[i]) + r, int(LOOKUP_CELLS) - 1);
+    }
+    for (int x = lo.x; x <= hi.x; ++x) for (int y = lo.y; y <= hi.y; ++y) for (int z = lo.z; z <= hi.z; ++z) {
+      const int shell = std::max(std::abs(x - int(center.x)), std::max(std::abs(y - int(center.y)), std::abs(z - int(center.z))));
+      if (shell != r) continue;
+      for (uint i : mCells[toCell(glm::uvec3(x, y, z))]) {
+        const glm::vec3 d = mColours[i] - pColour;
+        const float distance2 = glm::dot(d, d);
+        if (distance2 < bestDistance2 || (distance2 == bestDistance2 && i < best)) {
+          best = i;
+          bestDistance2 = distance2;
+        }
+      }
+    }
+    if (bestDistance2 <= (r * cellSize) * (r * cellSize)) break;
+  }
+  return best;
+}
+
+uint ColourPalette::addColour(const glm::vec3& pColour, float pDistance2) {
+  if (pDistance2 >= 0 && !mColours.empty()) {
+    const uint nearest = findNearest(pColour);
+    const glm::vec3 d = mColours[nearest] - pColour;
+    if (glm::dot(d, d) <= pDistance2) return nearest;
+  }
+  mCells[toCell(toCellPos(pColour))].push_back(mColours.size());
+  mColours.push_back(pColour);
+  return mColours.size() - 1;
+}
+
+void ColourPalette::readFromFile(const std::string& pPath) {
+  std::ifstream fin;
+  fin.open(pPath, std::ios::in);
+  if (!fin.is_open()) throw std::runtime_error("Could not open palette file");
+
+  std::string magic, version;
+  uint count;
+  fin >> magic >> version >> count;
+  if (!fin || magic != "JASC-PAL") throw std::runtime_error("Palette file isn't JASC-PAL");
+
+  *this = ColourPalette();
+  for (uint i = 0; i < count; ++i) {
+    uint r, g, b;
+    if (!(fin >> r >> g >> b)) throw std::runtime_error("Palette file is truncated");
+    addColour(glm::vec3(r, g, b) / 255.f, -1);
+  }
+}
+
+void ColourPalette::writeToFile(const std::string& pPath) const {
+  std::ofstream fout;
+  fout.open(pPath, std::ios::out);
+  if (!fout.is_open()) throw std::runtime_error("Could not open palette file");
+
+  fout << "JASC-PAL\n0100\n" << mColours.size() << '\n';
+  for (const glm::vec3& c : mColours) {
+    const glm::uvec3 rgb(glm::clamp(c, glm::vec3(0), glm::vec3(1)) * 255.f + 0.5f);
+    fout << rgb.x << ' ' << rgb.y << ' ' << rgb.z << '\n';
+  }
+
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write palette file");
+}
+
+uint ColourPalette::size() const {
+  return mColours.size();
+}
+
+const glm::vec3& ColourPalette::getColour(uint pIndex) const {
+  return mColours[pIndex];
+}
+
+const std::vector<glm::vec3>& ColourPalette::getColours() const {
+  return mColours;
+}
+
+ColourPalette ColourPalette::medianCut(const std::vector<glm::vec3>& pColours, const std::vector<uint64_t>& pWeights, uint pMaxColours) {
+  struct Box {
+    uint begin, end; // Range of order
+    uint axis;
+    float range;
+  };
+
+  std::vector<uint> order;
+  for (uint i = 0; i < pColours.size(); ++i)
+    if (pWeights[i]) order.push_back(i);
+
+  auto makeBox = [&](uint pBegin, uint pEnd) {
+    glm::vec3 lo(std::numeric_limits<float>::infinity()), hi(-std::numeric_limits<float>::infinity());
+    for (uint i = pBegin; i < pEnd; ++i) {
+      lo = glm::min(lo, pColours[order[i]]);
+      hi = glm::max(hi, pColours[order[i]]);
+    }
+    const glm::vec3 extent = hi - lo;
+    const uint axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+    return Box{pBegin, pEnd, axis, pEnd - pBegin > 1 ? extent[axis] : -1.f};
+  };
+
+  std::vector<Box> boxes;
+  if (!order.empty()) boxes.push_back(makeBox(0, order.size()));
+  while (boxes.size() < pMaxColours) {
+    auto widest = std::max_element(boxes.begin(), boxes.end(), [](const Box& pA, const Box& pB) { return pA.range < pB.range; });
+    if (widest == boxes.end() || widest->range < 0) break; // Every box is a single colour
+    const Box box = *widest;
+
+    std::sort(order.begin() + box.begin, order.begin() + box.end, [&](uint pA, uint pB) { return pColours[pA][box.axis] < pColours[pB][box.axis]; });
+
+    // Split where half the weight is on each side, keeping at least one colour in each half
+    const uint64_t total = std::accumulate(order.begin() + box.begin, order.begin() + box.end, uint64_t(0), [&](uint64_t pSum, uint pI) { return pSum + pWeights[pI]; });
+    uint64_t sum = 0;
+    uint split = box.begin + 1;
+    for (uint i = box.begin; i < box.end - 1; ++i) {
+      sum += pWeights[order[i]];
+      split = i + 1;
+      if (sum * 2 >= total) break;
+    }
+
+    *widest = makeBox(box.begin, split);
+    boxes.push_back(makeBox(split, box.end));
+  }
+
+  ColourPalette palette;
+  for (const Box& box : boxes) {
+    glm::dvec3 sum(0);
+    uint64_t weight = 0;
+    for (uint i = box.begin; i < box.end; ++i) {
+      sum += glm::dvec3(pColours[order[i]]) * double(pWeights[order[i]]);
+      weight += pWeights[order[i]];
+    }
+    palette.addColour(glm::vec3(sum / double(weight)), -1);
+  }
+  return palette;
+}
+
+uint ColourPalette::toCell(const glm::uvec3& pCellPos) {
+  return (pCellPos.x * LOOKUP_CELLS + pCellPos.y) * LOOKUP_CELLS + pCellPos.z;
+}
+
+glm::uvec3 ColourPalette::toCellPos(const glm::vec3& pColour) {
+  return glm::uvec3(glm::clamp(pColour * float(LOOKUP_CELLS), glm::vec3(0), glm::vec3(LOOKUP_CELLS - 1)));
+}
@@ -0,0 +1,135 @@
+#include "compactIndices.hpp"
+
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+std::vector<uint8_t> encodeCompactIndices(const std::vector<std::array<uint32_t, 8>>& pIndices, uint32_t pPaletteSize) {
+  if (pPaletteSize > std::numeric_limits<uint8_t>::max()) throw std::runtime_error("Compact octrees can't have more than 255 colours");
+  const uint32_t airIndex = std::numeric_limits<uint32_t>::max() - pPaletteSize;
+  const size_t nodeCount = pIndices.size();
+
+  // Offsets depend on where nodes are, which depends on how wide the offsets before them are. Offsets only ever
+  // widen so this settles, usually after one or two passes.
+  std::vector<uint8_t> wide(nodeCount, 0); // Bit i is set when child i needs a 32 bit offset
+  std::vector<uint64_t> positions(nodeCount + 1);
+  for (bool isChanged = true; isChanged;) {
+    isChanged = false;
+    for (size_t i = 0; i < nodeCount; ++i) {
+      uint64_t size = sizeof(uint16_t);
+      for (uint j = 0; j < 8; ++j) {
+        const uint32_t c = pIndices[i][j];
+        if (c > airIndex) size += sizeof(uint8_t);
+        else if (c < airIndex) size += wide[i] >> j & 1 ? sizeof(uint32_t) : sizeof(uint16_t);
+      }
+      positions[i + 1] = positions[i] + size;
+    }
+
+    for (size_t i = 0; i < nodeCount; ++i) {
+      for (uint j = 0; j < 8; ++j) {
+        const uint32_t c = pIndices[i][j];
+        if (c >= airIndex) continue;
+        if (c <= i || c >= nodeCount) throw std::runtime_error("Compact octree children have to come after their parent");
+        const uint64_t offset = positions[c] - positions[i];
+        if (offset > std::numeric_limits<uint32_t>::max()) throw std::runtime_error("Compact octree child is too far from its parent");
+        if (!(wide[i] >> j & 1) && offset > std::numeric_limits<uint16_t>::max()) {
+          wide[i] |= 1 << j;
+          isChanged = true;
+        }
+      }
+    }
+  }
+
+  std::vector<uint8_t> data(positions[nodeCount]);
+  for (size_t i = 0; i < nodeCount; ++i) {
+    uint8_t* out = data.data() + positions[i];
+    uint16_t kinds = 0;
+    uint8_t* child = out + sizeof(uint16_t);
+    for (uint j = 0; j < 8; ++j) {
+      const uint32_t c = pIndices[i][j];
+      ChildKind kind = ChildKind::Air;
+      if (c > airIndex) {
+        kind = ChildKind::Leaf;
+        *child++ = c - airIndex;
+      }
+      else if (c < airIndex) {
+        const uint32_t offset = positions[c] - positions[i];
+        if (wide[i] >> j & 1) {
+          kind = ChildKind::Node32;
+          std::memcpy(child, &offset, sizeof(uint32_t));
+          child += sizeof(uint32_t);
+        }
+        else {
+          kind = ChildKind::Node16;
+          const uint16_t offset16 = offset;
+          std::memcpy(child, &offset16, sizeof(uint16_t));
+          child += sizeof(uint16_t);
+        }
+      }
+      kinds |= uint16_t(kind) << (j * 2);
+    }
+    std::memcpy(out, &kinds, sizeof(uint16_t));
+  }
+
+  return data;
+}
+
+std::vector<std::array<uint32_t, 8>> decodeCompactIndices(const uint8_t* pData, size_t pSize, uint32_t pNodeCount, uint32_t pPaletteSize) {
+  const uint32_t airIndex = std::numeric_limits<uint32_t>::max() - pPaletteSize;
+  static constexpr uint8_t CHILD_SIZES[4] = {0, sizeof(uint8_t), sizeof(uint16_t), sizeof(uint32_t)};
+
+  auto readKinds = [&](uint64_t pPosition) {
+    if (pPosition + sizeof(uint16_t) > pSize) throw std::runtime_error("Compact octree is truncated");
+    uint16_t kinds;
+    std::memcpy(&kinds, pData + pPosition, sizeof(uint16_t));
+    return kinds;
+  };
+
+  // Find where every node starts first so offsets can be turned back into node numbers
+  std::vector<uint64_t> positions(pNodeCount);
+  uint64_t position = 0;
+  for (uint32_t i = 0; i < pNodeCount; ++i) {
+    positions[i] = position;
+    const uint16_t kinds = readKinds(position);
+    position += sizeof(uint16_t);
+    for (uint j = 0; j < 8; ++j) position += CHILD_SIZES[kinds >> (j * 2) & 3];
+  }
+  if (position != pSize) throw std::runtime_error("Compact octree size doesn't match its nodes");
+
+  // Children are usually the node after the last child found, which saves a search
+  std::vector<std::array<uint32_t, 8>> indices(pNodeCount);
+  uint32_t next = 0;
+  for (uint32_t i = 0; i < pNodeCount; ++i) {
+    const uint16_t kinds = readKinds(positions[i]);
+    const uint8_t* child = pData + positions[i] + sizeof(uint16_t);
+    for (uint j = 0; j < 8; ++j) {
+      const ChildKind kind = ChildKind(kinds >> (j * 2) & 3);
+      if (kind == ChildKind::Air) indices[i][j] = airIndex;
+      else if (kind == ChildKind::Leaf) {
+        if (!*child || *child > pPaletteSize) throw std::runtime_error("Invalid palette index in compact octree");
+        indices[i][j] = airIndex + *child++;
+      }
+      else {
+        uint32_t offset = 0;
+        if (kind == ChildKind::Node16) {
+          uint16_t offset16;
+          std::memcpy(&offset16, child, sizeof(uint16_t));
+          offset = offset16;
+        }
+        else std::memcpy(&offset, child, sizeof(uint32_t));
+        child += CHILD_SIZES[uint8_t(kind)];
+
+        const uint64_t target = positions[i] + offset;
+        if (next <= i || next >= pNodeCount || positions[next] != target) {
+          auto it = std::lower_bound(positions.begin() + i + 1, positions.end(), target);
+          if (!offset || it == positions.end() || *it != target) throw std::runtime_error("Invalid child offset in compact octree");
+          next = it - positions.begin();
+        }
+        indices[i][j] = next++;
+      }
+    }
+  }
+
+  return indices;
+}
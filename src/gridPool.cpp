@@ -0,0 +1,63 @@
+#include "gridPool.hpp"
+#include "memoryBudget.hpp"
+
+GridPool::Lease::Lease(GridPool* pPool, uint pResolution)
+:mPool(pPool), mGrid(pPool ? pPool->acquire(pResolution) : std::make_unique<VMesh::VoxelGrid>(pResolution)) {}
+
+GridPool::Lease::~Lease() {
+  if (mPool) mPool->release(std::move(mGrid));
+}
+
+GridPool::GridPool(uint64_t pMaxBytes)
+:mMaxBytes(pMaxBytes) {}
+
+std::unique_ptr<VMesh::VoxelGrid> GridPool::acquire(uint pResolution) {
+  std::vector<std::unique_ptr<VMesh::VoxelGrid>> unused;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (size_t i = mGrids.size(); i-- > 0;) {
+      if (mGrids[i]->getResolution() != pResolution) continue;
+      std::unique_ptr<VMesh::VoxelGrid> grid = std::move(mGrids[i]);
+      mGrids.erase(mGrids.begin() + i);
+      mIdleBytes -= getGridBytes(pResolution);
+
+      // Left as a previous job had it
+      grid->clear();
+      grid->setOrigin();
+      grid->mPalette = VMesh::Palette();
+      grid->setLogStream(nullptr);
+      return grid;
+    }
+    // Only as many idle grids are freed as it takes for the new one to fit, so a batch mixing resolutions keeps the
+    // grids its other resolutions will reuse
+    const uint64_t bytes = getGridBytes(pResolution);
+    size_t count = 0;
+    for (uint64_t idleBytes = mIdleBytes; count < mGrids.size() && idleBytes + bytes > mMaxBytes; ++count) idleBytes -= getGridBytes(mGrids[count]->getResolution());
+    for (size_t i = 0; i < count; ++i) {
+      mIdleBytes -= getGridBytes(mGrids[i]->getResolution());
+      unused.push_back(std::move(mGrids[i]));
+    }
+    mGrids.erase(mGrids.begin(), mGrids.begin() + count);
+  }
+  unused.clear(); // Freed outside the lock
+  return std::make_unique<VMesh::VoxelGrid>(pResolution);
+}
+
+void GridPool::release(std::unique_ptr<VMesh::VoxelGrid> pGrid) {
+  std::vector<std::unique_ptr<VMesh::VoxelGrid>> unused;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mIdleBytes += getGridBytes(pGrid->getResolution());
+    mGrids.push_back(std::move(pGrid));
+    size_t count = 0;
+    for (; count < mGrids.size() && mIdleBytes > mMaxBytes; ++count) {
+      mIdleBytes -= getGridBytes(mGrids[count]->getResolution());
+      unused.push_back(std::move(mGrids[count]));
+    }
+    mGrids.erase(mGrids.begin(), mGrids.begin() + count);
+  }
+}
+
+uint64_t GridPool::getGridBytes(uint pResolution) {
+  return uint64_t(pResolution) * pResolution * pResolution * MemoryBudget::GRID_BYTES_PER_VOXEL;
+}
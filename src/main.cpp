@@ -3,21 +3,209 @@
 
 #include "progressBar.hpp"
 #include "octree.hpp"
+#include "tree64.hpp"
+#include "triangleBins.hpp"
+#include "subtreeSpill.hpp"
+#include "subtreeCache.hpp"
+#include "vm8View.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "gridPool.hpp"
+#include "colourPalette.hpp"
+#include "voxReader.hpp"
+#include "meshCache.hpp"
+#include "memoryBudget.hpp"
 
 #include <array>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <optional>
+#include <atomic>
+#include <future>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
+#include <cctype>
+#include <shared_mutex>
+#include <filesystem>
+#include <thread>
+
+#include <unistd.h>
 
 #include <boost/program_options.hpp>
 
 namespace po = boost::program_options;
 
-int main(int argc, char** argv) {
-  uint resolution, subdivisionlevel;
-  bool isVerbose, isTribox, isBinary, isCreatePalette;
+static bool parseCoordinates(const std::string& pStr, std::vector<uint>& pValues, uint pCount) {
+  std::stringstream ss(pStr);
+  std::string value;
+  pValues.clear();
+  while (std::getline(ss, value, ',')) {
+    try {
+      pValues.push_back(boost::lexical_cast<uint>(value));
+    }
+    catch (boost::bad_lexical_cast&) {
+      return false;
+    }
+  }
+  return pValues.size() == pCount;
+}
+
+// VMesh's palette file is the way to get at its colours, each thread uses its own file
+static ColourPalette readColours(VMesh::Palette& pPalette) {
+  const std::filesystem::path path = std::filesystem::temp_directory_path() / std::format("vmesh-{}-{:x}.pal", getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+  pPalette.writeToFile(path.string());
+  ColourPalette colours;
+  colours.readFromFile(path.string());
+  std::filesystem::remove(path);
+  return colours;
+}
+
+// Sparse subdivisions whose bricks go past the memory budget are split into octants, down to this size
+static constexpr uint MIN_SPLIT_SIZE = 32;
+
+// Builds the pSize cube at pOrigin from pTriangles an octant at a time, octants whose bricks still grow past
+// pMaxBytes are split again. The octants are attached then collapsed so the tree is the same as one built whole.
+static std::optional<Octree> buildSplitSparse(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, const glm::uvec3& pOrigin, uint pSize, uint pPaletteSize,
+                                              uint64_t pMaxBytes, uint64_t& pVoxelCount, uint& pSplits) {
+  TRACE_SCOPE("buildSplitSparse");
+  ++pSplits;
+  const uint half = pSize / 2;
+  const uint64_t startVoxelCount = pVoxelCount;
+  TriangleBins bins(pMeshes, pTriangles, pOrigin, half, 2);
+  Octree octree(pSize, pPaletteSize);
+  for (uint i = 0; i < 8; ++i) {
+    if (!bins.getTriCount(i)) continue;
+    glm::uvec3 offset = glm::uvec3(i / 4, (i / 2) % 2, i % 2) * half;
+
+    std::optional<Octree> child;
+    bool isWithinBudget;
+    {
+      SparseVoxels voxels(half, pOrigin + offset);
+      if (half > MIN_SPLIT_SIZE) voxels.setMaxBytes(pMaxBytes);
+      isWithinBudget = voxels.voxelizeTriangles(pMeshes, bins.getTriangles(i));
+      if (isWithinBudget && voxels.getVoxelCount()) {
+        pVoxelCount += voxels.getVoxelCount();
+        child.emplace(voxels, pPaletteSize);
+      }
+    }
+    if (!isWithinBudget) child = buildSplitSparse(pMeshes, bins.getTriangles(i), pOrigin + offset, half, pPaletteSize, pMaxBytes, pVoxelCount, pSplits);
+    if (child) octree.attach(*child, offset);
+  }
+  if (pVoxelCount == startVoxelCount) return std::nullopt;
+  octree.collapse();
+  return octree;
+}
+
+static int query(int argc, char** argv) {
+  std::string in;
+  std::vector<std::string> points, boxes;
+  bool isStdin;
+  uint traversals;
+
+  po::options_description visibleOptions("Options", 100, 40);
+  visibleOptions.add_options()
+    ("help,h", "produce help message")
+    ("point,p", po::value<std::vector<std::string>>(&points)->composing(), "query the voxel at x,y,z")
+    ("box,b", po::value<std::vector<std::string>>(&boxes)->composing(), "count the voxels of each palette index in the box x0,y0,z0,x1,y1,z1 where x1,y1,z1 is exclusive")
+    ("stdin", po::bool_switch(&isStdin), "read whitespace separated x y z points from stdin until eof and print the voxel at each")
+    ("traversal", po::value<uint>(&traversals), "walk this many random root to leaf paths and print the average nodes, 64 byte cache lines and misses in a 32KiB cache each touches")
+  ;
+
+  po::options_description hiddenOptions("Hidden");
+  hiddenOptions.add_options()
+    ("in", po::value<std::string>(&in), "input file path")
+  ;
+
+  po::positional_options_description p;
+  p.add("in", 1);
+
+  po::options_description options("Options", 100, 40);
+  options.add(visibleOptions).add(hiddenOptions);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(options).positional(p).run(), vm);
+  }
+  catch (po::error& pErr) {
+    std::println("{}, use -h for help", pErr.what());
+    return 1;
+  }
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::println("Usage: vmesh query OPTIONS input-path\n\nQuery voxels in a vm8 file without loading it\n");
+    std::cout << visibleOptions;
+    return 0;
+  }
+
+  if (!vm.count("in")) {
+    std::println("Missing input file path, use -h for help");
+    return 1;
+  }
+
+  Vm8View view(in);
+  std::println("Octree resolution: {}, palette size: {}, nodes: {}", view.getResolution(), view.getPaletteSize(), view.getNodeCount());
+
+  if (vm.count("traversal") && traversals) {
+    VMesh::Timer t;
+    const Vm8View::TraversalStats s = view.measureTraversal(traversals);
+    std::println("Traversal: {:.2f} nodes, {:.2f} cache lines, {:.2f} misses per lookup, took: {}", s.nodes, s.lines, s.misses, t.getTime());
+  }
+
+  std::vector<uint> c;
+  for (const std::string& point : points) {
+    if (!parseCoordinates(point, c, 3)) {
+      std::println("Invalid point {}, use -h for help", point);
+      return 1;
+    }
+    glm::uvec3 pos(c[0], c[1], c[2]);
+    if (pos.x >= view.getResolution() || pos.y >= view.getResolution() || pos.z >= view.getResolution()) {
+      std::println("{},{},{}: out of range", pos.x, pos.y, pos.z);
+      continue;
+    }
+    std::println("{},{},{}: {}", pos.x, pos.y, pos.z, view.lookup(pos));
+  }
+
+  for (const std::string& box : boxes) {
+    if (!parseCoordinates(box, c, 6)) {
+      std::println("Invalid box {}, use -h for help", box);
+      return 1;
+    }
+    const glm::uvec3 min(c[0], c[1], c[2]);
+    const glm::uvec3 max = glm::min(glm::uvec3(c[3], c[4], c[5]), glm::uvec3(view.getResolution()));
+    std::vector<uint64_t> counts(view.getPaletteSize() + 1, 0);
+    view.iterateRegion(min, max, [&](const glm::uvec3& pOrigin, uint pSize, uint pValue) {
+      const glm::uvec3 from = glm::max(pOrigin, min);
+      const glm::uvec3 to = glm::min(pOrigin + glm::uvec3(pSize), max);
+      counts.at(pValue) += uint64_t(to.x - from.x) * (to.y - from.y) * (to.z - from.z);
+    });
+    std::println("{},{},{} - {},{},{}: {} solid voxels", min.x, min.y, min.z, max.x, max.y, max.z, std::accumulate(counts.begin() + 1, counts.end(), uint64_t(0)));
+    for (uint i = 1; i < counts.size(); ++i)
+      if (counts[i]) std::println("  {}: {}", i, counts[i]);
+  }
+
+  if (isStdin) {
+    glm::uvec3 pos;
+    while (std::cin >> pos.x >> pos.y >> pos.z) {
+      if (pos.x >= view.getResolution() || pos.y >= view.getResolution() || pos.z >= view.getResolution()) std::cout << "out of range\n";
+      else std::cout << view.lookup(pos) << '\n';
+    }
+    std::cout << std::flush;
+  }
+
+  return 0;
+}
+
+// Voxelizes or converts one input, grids come from pGridPool when running as part of a batch
+static int convert(int argc, char** argv, GridPool* pGridPool = NULL) {
+  uint resolution, subdivisionlevel, jobs, lods;
+  bool isVerbose, isTribox, isBinary, isCreatePalette, isDAG, isSparse, isNoProgress, isMedianCut, isCompact;
   float addColourDistance2;
-  std::string in, out, outputFormat, palettePath, scaleMode, addColourDistanceStr;
+  uint64_t maxMemory = 0;
+  std::string in, out, outputFormat, palettePath, scaleMode, addColourDistanceStr, maxMemoryStr, spillDirectory, subtreeCacheDirectory, meshCacheDirectory, statsPath, tracePath, layoutStr;
+  Octree::Layout layout;
 
   // VMesh::Palette testPalette;
   // for (uint r = 0; r <= 255; ++r) {
@@ -36,14 +224,28 @@ int main(int argc, char** argv) {
   visibleOptions.add_options()
     ("help,h", "produce help message")
     ("verbose,v", po::bool_switch(&isVerbose), "verbose output")
+    ("no-progress", po::bool_switch(&isNoProgress), "don't draw progress bars, they're also left out when stdout isn't a terminal")
+    ("stats-json", po::value<std::string>(&statsPath), "write wall and cpu time of each phase and subdivision, peak memory, counts and throughput to this json file")
+    ("mesh-cache", po::value<std::string>(&meshCacheDirectory), "cache the model's positions, indices and bounds in this directory, later runs on the same unchanged file memory map it, --sparse runs then skip loading the model entirely")
+    ("trace", po::value<std::string>(&tracePath), "write a chrome trace of where time goes to this json file, open it in chrome://tracing or ui.perfetto.dev")
     ("format,f", po::value<std::string>(&outputFormat), "specify output format (vmu, vmc, vm8, vm64)")
     ("palette,P", po::value<std::string>(&palettePath), "specify path to an existing palette to use rather than create one")
     ("resolution,R", po::value<uint>(&resolution)->default_value(128), "set voxel grid resolution")
-    ("subdivision-level,L", po::value<uint>(&subdivisionlevel)->default_value(0), "set depth to generate initial subtrees before combining for out of core generation")
+    ("subdivision-level,L", po::value<uint>(&subdivisionlevel)->default_value(0), "set depth to generate initial subtrees before combining for out of core generation, MagicaVoxel input converted to vm8 is streamed a subtree at a time but vmu and vmc input is always loaded whole")
+    ("jobs,j", po::value<uint>(&jobs)->default_value(1), "set number of subdivisions to generate in parallel, each job allocates its own subdivision sized grid, without subdivisions the octree of the one grid is built in parallel instead")
+    ("max-memory", po::value<std::string>(&maxMemoryStr), "pick the subdivision level, and jobs when they aren't given, so estimated peak memory stays under this many bytes, K, M, G and T suffixes are powers of 1024, sparse subdivisions that grow past it are split while voxelizing")
+    ("spill-dir", po::value<std::string>(&spillDirectory), "write finished subdivisions to temporary files in this directory instead of keeping them in memory, they're merged into the vm8 at the end")
+    ("subtree-cache", po::value<std::string>(&subtreeCacheDirectory), "keep each subdivision's octree in this directory keyed by a hash of its triangles and the settings, later runs read back the subdivisions whose triangles haven't changed, only for binary octrees")
     ("scale-mode", po::value<std::string>(&scaleMode)->default_value("proportional"), "scaling mode either (proportional, stretch, none)")
-    ("tribox", po::bool_switch(&isTribox), "use triangle box intersections instead of DDA voxelization, it tends to be faster on low resolutions(<512) however it only generates binary data")
+    ("tribox", po::bool_switch(&isTribox), "use triangle box intersections instead of DDA voxelization, it tends to be faster on low resolutions(<512) however it only generates binary data, vm8 subdivisions only rasterize the triangles that overlap them")
     ("binary,B", po::bool_switch(&isBinary), "generate binary voxel data instead of coloured voxel data")
+    ("sparse", po::bool_switch(&isSparse), "voxelize triangles straight into a sparse octree without allocating a dense voxel grid, memory scales with surface area so very high resolutions don't need -L, it only generates binary data")
+    ("dag", po::bool_switch(&isDAG), "merge identical subtrees into shared nodes when writing vm8, producing a sparse voxel DAG")
+    ("compact", po::bool_switch(&isCompact), "write vm8 with byte packed nodes where air takes no space, leaves are a byte and children are relative 16 or 32 bit offsets")
+    ("layout", po::value<std::string>(&layoutStr)->default_value("breadth-first"), "order vm8 nodes are stored in either (breadth-first, depth-first, blocked), blocked keeps each 4 level subtree together")
+    ("lods", po::value<uint>(&lods)->default_value(1), "write this many levels of detail for vm8, each coarser level halves the resolution and is written as output-path_lodN")
     ("colour-distance", po::value<std::string>(&addColourDistanceStr)->default_value("0.1"), "set the euclidean distance between two normalized rgb colours that is required for a new colour to be added to the palette")
+    ("median-cut", po::bool_switch(&isMedianCut), "keep every colour found with colour-distance then median cut them by voxel count down to at most 255 colours, instead of failing when there are more than 255")
   ;
 
   po::options_description hiddenOptions("Hidden");
@@ -72,10 +274,13 @@ int main(int argc, char** argv) {
     return 1;
   }
   po::notify(vm);
+
+  // Batches decide this once for every job
+  if (!pGridPool && (isNoProgress || !isatty(STDOUT_FILENO))) setProgressBarsEnabled(false);
   
   // Help
   if (vm.count("help")) {
-    std::println("Usage: vmesh OPTIONS input-path output-path(optional)\n\nMesh voxelizer\n");
+    std::println("Usage: vmesh OPTIONS input-path output-path(optional)\n       vmesh query OPTIONS input-path\n       vmesh --batch manifest-path OPTIONS\n\nMesh voxelizer\n");
     std::cout << visibleOptions;
     return 0;
   }
@@ -117,31 +322,146 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  // Temp
-  if (outputFormat == "vm64") {
-    std::println("64trees are not supported yet");
-    return 1;
-  }
-  
   // Resolution
   if (outputFormat == "vm8" && (!resolution || resolution & (resolution - 1))) {
     std::println("Octree resolution has to be a power of 2");
     return 1;
   }
 
-  // Subdivision level
+  if (outputFormat == "vm64" && (!resolution || resolution & (resolution - 1) || !(resolution & 0x55555555))) {
+    std::println("64tree resolution has to be a power of 4");
+    return 1;
+  }
+
+  // Subdivision level, it's checked against the resolution once the input is known to be a mesh
   float logRes = std::log2f(resolution);
-  if (subdivisionlevel > logRes) {
-    std::println("Subdivision level has to be in range 0,log2(resolution)={} inclusive", logRes);
+  if ((subdivisionlevel != 0) && (outputFormat != "vm8") && (outputFormat != "vm64")) {
+    std::println("Out of core generation is currently only supported for octrees and 64trees");
     return 1;
   }
 
-  if ((subdivisionlevel != 0) && (outputFormat != "vm8")) {
-    std::println("Out of core generation is currently only supported for octrees");
+  if ((subdivisionlevel & 1) && (outputFormat == "vm64")) {
+    std::println("Subdivision level has to be even for 64trees");
     return 1;
   }
 
-  if (isTribox) isBinary = true;
+  // Memory budget
+  if (vm.count("max-memory")) {
+    if (!MemoryBudget::parseBytes(maxMemoryStr, maxMemory)) {
+      std::println("Invalid max memory, use -h for help");
+      return 1;
+    }
+    if (outputFormat != "vm8" && outputFormat != "vm64") {
+      std::println("Memory budgets are only supported for octrees and 64trees");
+      return 1;
+    }
+  }
+
+  // Jobs
+  if (!jobs) {
+    std::println("Jobs has to be at least 1");
+    return 1;
+  }
+
+  if (isDAG && outputFormat != "vm8") {
+    std::println("Subtree deduplication is only supported for octrees");
+    return 1;
+  }
+
+  if (isCompact && (outputFormat != "vm8" || vm.count("spill-dir"))) {
+    std::println("Compact output is only supported for octrees that aren't spilled");
+    return 1;
+  }
+
+  if (vm.count("spill-dir") && (outputFormat != "vm8" || isDAG)) {
+    std::println("Spilling subdivisions is only supported for octrees without subtree deduplication");
+    return 1;
+  }
+
+  if (!Octree::parseLayout(layoutStr, layout)) {
+    std::println("Invalid layout, use -h for help");
+    return 1;
+  }
+
+  if (layout != Octree::Layout::BreadthFirst && (outputFormat != "vm8" || vm.count("spill-dir"))) {
+    std::println("Layouts are only supported for octrees that aren't spilled");
+    return 1;
+  }
+
+  if (!lods) {
+    std::println("LODs has to be at least 1");
+    return 1;
+  }
+
+  if (lods > 1 && (outputFormat != "vm8" || vm.count("spill-dir"))) {
+    std::println("LODs are only supported for octrees that aren't spilled");
+    return 1;
+  }
+
+  if (isSparse && outputFormat != "vm8") {
+    std::println("Sparse voxelization is only supported for octrees");
+    return 1;
+  }
+
+  if (isTribox || isSparse) isBinary = true;
+
+  if (vm.count("subtree-cache") && (outputFormat != "vm8" || !isBinary)) {
+    std::println("Subtree caching is only supported for binary octrees");
+    return 1;
+  }
+
+  if (isMedianCut && (outputFormat != "vm8" || vm.count("spill-dir") || isBinary || !isCreatePalette)) {
+    std::println("Median cut is only supported for coloured octrees that aren't spilled and create their own palette");
+    return 1;
+  }
+
+  if (vm.count("trace")) {
+#ifndef _PROFILING
+    std::println("Tracing needs a build with _PROFILING defined");
+    return 1;
+#endif
+    // Trace zones are kept for the whole process so a job's trace would have every other job in it
+    if (pGridPool) {
+      std::println("Batch jobs can't be traced on their own, give --trace to --batch instead");
+      return 1;
+    }
+    startTrace();
+    setTraceThreadName("main");
+  }
+
+  Stats stats;
+  stats.mInput = in;
+  stats.mOutputFormat = outputFormat;
+  stats.mResolution = resolution;
+  stats.mSubdivisionLevel = subdivisionlevel;
+  stats.mJobs = jobs;
+  auto writeReports = [&]() {
+    if (!statsPath.empty()) {
+      stats.mBytesWritten = Stats::getFileSize({out + "." + outputFormat, out});
+      std::println("Writing stats to: \e[1;3;4;33m{}\e[0m", statsPath);
+      stats.write(statsPath);
+    }
+    if (!tracePath.empty()) {
+      std::println("Writing trace to: \e[1;3;4;33m{}\e[0m", tracePath);
+      writeTrace(tracePath);
+    }
+  };
+  // Coarser levels are derived from the finest octree rather than voxelizing again
+  auto writeLODs = [&](Octree& pOctree) {
+    if (lods < 2) return;
+    Stats::Scope scope(stats, "lods");
+    std::optional<Octree> lod;
+    for (uint i = 1; i < lods; ++i) {
+      Octree& finer = lod ? *lod : pOctree;
+      if (finer.getResolution() == 1) {
+        std::println("Octree resolution is 1, stopping at {} LODs", i);
+        break;
+      }
+      lod = finer.downsample();
+      std::println("LOD {} resolution: {}", i, lod->getResolution());
+      lod->write(std::format("{}_lod{}", out, i), isDAG, layout, isCompact);
+    }
+  };
 
   // ############
   // - Generate -
@@ -174,6 +494,25 @@ int main(int argc, char** argv) {
   }
   fin.close();
 
+  // Budgets are estimated from the mesh's triangles
+  if (maxMemory && (isConvertVox || isConvertU || isConvertC)) {
+    std::println("Memory budgets are only supported for mesh input");
+    return 1;
+  }
+
+  // Voxel files have their own resolution, streamed MagicaVoxel files check -L against it once it's read and writing
+  // LODs stops at resolution 1
+  if (!isConvertVox && !isConvertU && !isConvertC) {
+    if (subdivisionlevel > logRes) {
+      std::println("Subdivision level has to be in range 0,log2(resolution)={} inclusive", logRes);
+      return 1;
+    }
+    if (lods - 1 > logRes) {
+      std::println("LODs has to be in range 1,log2(resolution)+1={} inclusive", logRes + 1);
+      return 1;
+    }
+  }
+
   // Print what is going on
   std::string outputFormatFull;
   if (outputFormat == "vmu") outputFormatFull = "uncompressed voxel data";
@@ -186,13 +525,130 @@ int main(int argc, char** argv) {
   else if (isConvertC) std::println("Converting compressed voxel data to {}", outputFormatFull);
   else std::println("Generating {} from 3d model", outputFormatFull);
 
+  // Convert magica voxel files to octrees a brick at a time so the dense volume is never allocated
+  std::optional<VoxReader> voxReader;
+  if (isConvertVox && subdivisionlevel && outputFormat == "vm8") {
+    voxReader.emplace(in);
+    if (!voxReader->hasPalette()) {
+      std::println("Magica voxel file uses the default palette, loading it whole");
+      voxReader.reset();
+    }
+  }
+  if (voxReader) {
+    const glm::uvec3 size = voxReader->getSize();
+    for (resolution = 1; resolution < std::max(size.x, std::max(size.y, size.z)); resolution <<= 1) {}
+    if (subdivisionlevel > uint(std::countr_zero(resolution))) {
+      std::println("Subdivision level has to be in range 0,log2(resolution)={} inclusive, the octree resolution of this file is {}", std::countr_zero(resolution), resolution);
+      return 1;
+    }
+    const uint brickSize = resolution >> subdivisionlevel;
+    const uint dimensions = 1 << subdivisionlevel;
+    const uint numBricks = dimensions * dimensions * dimensions;
+    stats.mResolution = resolution;
+    stats.mVoxels = voxReader->getVoxelCount();
+
+    const ColourPalette& colours = voxReader->getPalette();
+    stats.mPaletteSize = colours.size();
+    std::println("Writing pallete to: \e[1;3;4;33m{}\e[0m", paletteOut);
+    colours.writeToFile(paletteOut);
+
+    // The first read counts each brick's solid voxels. Bricks are then taken in runs of at most a brick's volume of
+    // voxels and the file is read again for each run, keeping only that run's voxels, so memory follows the brick size
+    // rather than the model.
+    auto toBrick = [&](const glm::uvec3& pPos) {
+      const glm::uvec3 brick = pPos / brickSize;
+      return (brick.x * dimensions + brick.y) * dimensions + brick.z;
+    };
+    const uint64_t brickVolume = uint64_t(brickSize) * brickSize * brickSize;
+    std::vector<uint64_t> brickVoxelCounts(numBricks, 0);
+    {
+      VMesh::Timer t;
+      Stats::Scope scope(stats, "load");
+      voxReader->readVoxels([&](const glm::uvec3& pPos, uint8_t pIndex) {
+        if (pIndex) ++brickVoxelCounts[toBrick(pPos)];
+      });
+      std::println("Counting voxels took: {}", t.getTime());
+    }
+
+    // Only one brick is ever dense. Voxels of a run are kept as their morton code within their brick above their colour
+    // index, a VOX model is at most 256 voxels wide so that fits in 32 bits.
+    Octree svo(resolution, colours.size());
+    std::vector<uint8_t> voxels(brickVolume);
+    std::vector<std::vector<uint32_t>> bricks;
+    uint reads = 0;
+    std::mutex stdoutMutex;
+    std::atomic<uint64_t> bricksComplete = 0;
+    ProgressBar f = startProgressBar(&stdoutMutex, "Bricks", &bricksComplete, numBricks);
+    VMesh::Timer t;
+    Stats::Scope generateScope(stats, "generate");
+    for (uint first = 0; first < numBricks;) {
+      uint last = first;
+      uint64_t runVoxelCount = 0;
+      while (last < numBricks && (last == first || runVoxelCount + brickVoxelCounts[last] <= brickVolume)) runVoxelCount += brickVoxelCounts[last++];
+
+      if (runVoxelCount) {
+        bricks.assign(last - first, {});
+        for (uint i = first; i < last; ++i) bricks[i - first].reserve(brickVoxelCounts[i]);
+        voxReader->readVoxels([&](const glm::uvec3& pPos, uint8_t pIndex) {
+          const uint i = toBrick(pPos);
+          if (!pIndex || i < first || i >= last) return;
+          bricks[i - first].push_back(uint32_t(Octree::toMorton(pPos - pPos / brickSize * brickSize)) << 8 | pIndex);
+        });
+        ++reads;
+      }
+
+      for (uint i = first; i < last; ++i) {
+        if (brickVoxelCounts[i]) {
+          std::fill(voxels.begin(), voxels.end(), 0);
+          for (uint32_t v : bricks[i - first]) voxels[v >> 8] = v & 0xff;
+          std::vector<uint32_t>().swap(bricks[i - first]);
+
+          Octree brick(voxels, brickSize, colours.size());
+          glm::uvec3 origin(i / (dimensions * dimensions), (i / dimensions) % dimensions, i % dimensions);
+          origin *= brickSize;
+          svo.attach(brick, origin);
+        }
+        ++bricksComplete;
+      }
+      first = last;
+    }
+    generateScope.end();
+    f.wait();
+    std::println("Generating SVO took: {}, the voxels were read {} more times", t.getTime(), reads);
+    std::println("Octree resolution: {}", svo.getResolution());
+
+    {
+      Stats::Scope scope(stats, "collapse");
+      t.start();
+      stats.mCollapsedNodes = svo.collapse();
+      std::println("Collapsing uniform subtrees removed {} nodes, took: {}", stats.mCollapsedNodes, t.getTime());
+    }
+
+    stats.mNodes = svo.getNodeCount();
+    {
+      Stats::Scope scope(stats, "write");
+      svo.write(out, isDAG, layout, isCompact);
+    }
+    writeLODs(svo);
+    writeReports();
+
+    std::println("Complete");
+    return 0;
+  }
+
   // Convert
   if (isConvertVox || isConvertU || isConvertC) {
+    if (subdivisionlevel && (isConvertU || isConvertC)) std::println("Subdivision level is ignored for vmu and vmc input, they're loaded whole");
     VMesh::VoxelGrid voxelGrid(resolution);
     // if (isBinary) voxelGrid.mPalette.addColour({1,1,1});
-    if (isConvertVox) voxelGrid.loadFromVoxFile(in);
-    else if (isConvertU) voxelGrid.loadFromFile(in);
-    else voxelGrid.loadFromFileCompressed(in);
+    {
+      Stats::Scope scope(stats, "load");
+      if (isConvertVox) voxelGrid.loadFromVoxFile(in);
+      else if (isConvertU) voxelGrid.loadFromFile(in);
+      else voxelGrid.loadFromFileCompressed(in);
+    }
+    stats.mVoxels = voxelGrid.getVoxelCount();
+    stats.mPaletteSize = voxelGrid.mPalette.size();
 
     if (isConvertVox) {
       std::println("Writing pallete to: \e[1;3;4;33m{}\e[0m", paletteOut);
@@ -200,175 +656,661 @@ int main(int argc, char** argv) {
     }
 
     if (outputFormat == "vmu") {
-      voxelGrid.writeToFile(out);
+      {
+        Stats::Scope scope(stats, "write");
+        voxelGrid.writeToFile(out);
+      }
+      writeReports();
       std::println("Complete");
       return 0;
     }
     if (outputFormat == "vmc") {
-      uint64_t voxelsComplete = 0;
-      std::future<void> f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Compressing", &voxelsComplete, voxelGrid.getVolume());
-      voxelGrid.writeToFileCompressed(out, &voxelsComplete);
+      {
+        Stats::Scope scope(stats, "write");
+        uint64_t voxelsComplete = 0;
+        ProgressBar f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Compressing", &voxelsComplete, voxelGrid.getVolume());
+        voxelGrid.writeToFileCompressed(out, &voxelsComplete);
+        f.wait();
+      }
+      writeReports();
+      std::println("Complete");
+      return 0;
+    }
+
+    if (outputFormat == "vm64") {
+      for (resolution = 1; resolution < voxelGrid.getResolution(); resolution <<= 2) {}
+
+      std::atomic<uint64_t> completedCount = 0;
+      uint64_t total = uint64_t(resolution) * resolution * resolution;
+      ProgressBar f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Generating 64tree", &completedCount, total);
+      VMesh::Timer t;
+      Stats::Scope generateScope(stats, "generate");
+      Tree64 tree(voxelGrid, &completedCount);
+      generateScope.end();
+      f.wait();
+      std::println("Generating 64tree took: {}", t.getTime());
+
+      if (isConvertVox) std::println("64tree resolution: {}", tree.getResolution());
+
+      stats.mNodes = tree.getNodeCount();
+      {
+        Stats::Scope scope(stats, "write");
+        tree.write(out);
+      }
+      writeReports();
+
       std::println("Complete");
       return 0;
     }
 
     for (resolution = 1; resolution < voxelGrid.getResolution(); resolution <<= 1) {}
 
-    uint64_t completedCount = 0;
-    uint64_t total = std::log2f(resolution) * resolution * resolution * resolution;
-    std::future<void> f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Generating SVO", &completedCount, total);
+    std::atomic<uint64_t> completedCount = 0;
+    uint64_t total = uint64_t(resolution) * resolution * resolution;
+    ProgressBar f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Generating SVO", &completedCount, total);
     VMesh::Timer t;
-    Octree svo(voxelGrid, &completedCount);
+    Stats::Scope generateScope(stats, "generate");
+    Octree svo(voxelGrid, &completedCount, jobs);
+    generateScope.end();
     f.wait();
     std::println("Generating SVO took: {}", t.getTime());
 
     if (isConvertVox) std::println("Octree resolution: {}", svo.getResolution());
 
-    svo.write(out);
+    stats.mNodes = svo.getNodeCount();
+    {
+      Stats::Scope scope(stats, "write");
+      svo.write(out, isDAG, layout, isCompact);
+    }
+    writeLODs(svo);
+    writeReports();
 
     std::println("Complete");
     return 0;
   }
 
-  // Load model
+  // Load model, or map its cache
   VMesh::Model model;
-  {
+  MeshCache meshCache;
+  std::string meshCachePath;
+  bool isMeshCached = false, isModelLoaded = false;
+  Stats::Scope loadScope(stats, "load");
+  if (vm.count("mesh-cache")) {
+    meshCachePath = MeshCache::getPath(meshCacheDirectory, in);
+    isMeshCached = meshCache.open(meshCachePath, in);
+    if (isMeshCached) std::println("Using mesh cache: {}", meshCachePath);
+  }
+  // Triangle box octrees are rasterized a triangle at a time like sparse ones so a subdivision only visits its own
+  // triangles. VMesh's DDA only voxelizes a whole model it loaded and takes colours from its materials, so DDA
+  // subdivisions still pass over every triangle and only rasterized runs can go without a model.
+  const bool isRasterized = isSparse || (isTribox && outputFormat == "vm8");
+  if (!isMeshCached || !isRasterized) {
     std::println("Loading model...");
     VMesh::Timer t;
     model.load(in);
+    isModelLoaded = true;
     std::println("Loading model took: {}", t.getTime());
   }
+  loadScope.end();
+  const uint64_t triCount = isModelLoaded ? model.getTriCount() : meshCache.getTriCount();
+  stats.mTriangles = triCount;
+
+  Stats::Scope transformScope(stats, "transform");
 
   // Get smallest and largest positions in each axis of the models vertices
-  glm::vec3 smallest = glm::vec3(std::numeric_limits<float>::infinity());
-  glm::vec3 largest = glm::vec3(-std::numeric_limits<float>::infinity());
-  for (uint i = 0; i < model.getNumMeshes(); ++i) {
-    VMesh::Mesh& m = model.getMesh(i);
-    const std::vector<VMesh::Vertex>& meshVertices = m.getVertices();
-    const std::vector<uint>& meshIndices = m.getIndices();
-    for (uint j = 0; j < meshIndices.size(); ++j) {
-      glm::vec3 v = meshVertices[meshIndices[j]].pos;
-      smallest = glm::min(smallest, v);
-      largest = glm::max(largest, v);
+  glm::vec3 smallest, largest;
+  if (isMeshCached) {
+    smallest = meshCache.getSmallest();
+    largest = meshCache.getLargest();
+  }
+  else {
+    std::vector<MeshView> meshes = getMeshViews(model);
+    getMeshBounds(meshes, smallest, largest);
+    if (vm.count("mesh-cache")) {
+      VMesh::Timer t;
+      MeshCache::write(meshCachePath, in, meshes, smallest, largest);
+      std::println("Writing mesh cache to: {} took: {}", meshCachePath, t.getTime());
     }
   }
 
   // Create transformation matrix to fit model inside the grid
-  glm::mat4 m(1.0f);
-  if (scaleMode == "stretch")
-    m = glm::scale(m, glm::vec3(resolution-1, resolution-1, resolution-1) / (largest + (glm::vec3(0, 0, 0) - smallest)) );
-  else if (scaleMode == "proportional") {
-    glm::vec3 vec(glm::vec3(resolution-1, resolution-1, resolution-1) / (largest + (glm::vec3(0, 0, 0) - smallest)));
-    float v = std::min(vec.x, std::min(vec.y, vec.z));
-    m = glm::scale(m,  glm::vec3(v, v, v));
-  }
-  m = glm::translate(m, glm::vec3(0, 0, 0) - smallest);
-  
-  for (uint i = 0; i < model.getNumMeshes(); ++i)
-    model.getMesh(i).transformVertices(m);
+  const glm::mat4 m = getFitMatrix(smallest, largest, resolution, scaleMode);
+
+  if (isModelLoaded) {
+    for (uint i = 0; i < model.getNumMeshes(); ++i)
+      model.getMesh(i).transformVertices(m);
+  }
+  else meshCache.transform(m);
+  const std::vector<MeshView> meshes = isModelLoaded ? getMeshViews(model) : meshCache.getMeshViews();
+  transformScope.end();
+
+  // Levels and jobs given on the command line are kept, the budget picks the rest
+  uint64_t sparseBudget = 0;
+  if (maxMemory) {
+    MemoryBudget budget(maxMemory, resolution, meshes, isRasterized, vm.count("spill-dir"));
+    const bool isLevelSet = !vm["subdivision-level"].defaulted(), isJobsSet = !vm["jobs"].defaulted();
+    const uint levelStep = outputFormat == "vm64" ? 2 : 1;
+    const uint maxLevel = isLevelSet ? subdivisionlevel : uint(logRes) / levelStep * levelStep;
+    const uint minJobs = isJobsSet ? jobs : 1;
+    const uint maxJobs = isJobsSet ? jobs : std::max(std::thread::hardware_concurrency(), 1u);
+    const bool isFitting = budget.plan(isLevelSet ? subdivisionlevel : 0, maxLevel, levelStep, minJobs, maxJobs, subdivisionlevel, jobs);
+    const double estimateMiB = budget.estimate(subdivisionlevel, jobs) / double(1 << 20);
+    if (isFitting) std::println("Memory budget: -L {} -j {}, estimated peak {:.1f} MiB", subdivisionlevel, jobs, estimateMiB);
+    else std::println("Memory budget: nothing fits in {:.1f} MiB{}, using -L {} -j {} estimated at {:.1f} MiB{}", maxMemory / double(1 << 20), isJobsSet ? " with the given -j" : "",
+                      subdivisionlevel, jobs, estimateMiB, vm.count("spill-dir") ? "" : ", --spill-dir keeps finished subdivisions out of memory");
+    if (isRasterized) sparseBudget = budget.getSparseBudget(subdivisionlevel, jobs);
+    stats.mSubdivisionLevel = subdivisionlevel;
+    stats.mJobs = jobs;
+  }
 
   // Generate
-  if (outputFormat == "vm8") {
+  if (outputFormat == "vm8" || outputFormat == "vm64") {
+    const bool is64 = outputFormat == "vm64";
     uint subdivisionSize = resolution >> subdivisionlevel;
     uint numSubdivisions = resolution / subdivisionSize;
     numSubdivisions = numSubdivisions * numSubdivisions * numSubdivisions;
     uint subdimensions = 1 << subdivisionlevel;
     
-    std::chrono::duration<double> totalVoxelizationTime, totalOctreeGenerationTime, temp;
+    // A single subdivision builds its octree with every job instead
+    const uint octreeJobs = numSubdivisions == 1 ? jobs : 1;
+    jobs = std::min(jobs, numSubdivisions);
 
-    VMesh::VoxelGrid grid(subdivisionSize);
-    if (isTribox || isBinary) grid.mPalette.addColour({1,1,1});
-    if (!isCreatePalette) grid.mPalette.readFromFile(palettePath);
-    if (isVerbose) grid.setLogStream(&std::cout);
+    // Bin triangles into subdivisions so subdivisions without any can be skipped and sparse voxelization only rasterizes its own
+    std::optional<TriangleBins> bins;
+    if (subdivisionlevel || sparseBudget) {
+      VMesh::Timer t;
+      Stats::Scope scope(stats, "bin");
+      bins.emplace(meshes, subdivisionSize, subdimensions);
+      std::println("Binning triangles took: {}, {}/{} subdivisions are empty", t.getTime(), bins->getEmptyCellCount(), numSubdivisions);
+    }
 
-    Octree parentSVO(resolution, isCreatePalette ? 255 : grid.mPalette.size());
+    std::chrono::duration<double> totalVoxelizationTime, totalOctreeGenerationTime;
 
-    uint subdivision = 0;
-    for (glm::uvec3 o(0); o.x < subdimensions; ++o.x) for (o.y = 0; o.y < subdimensions; ++o.y) for (o.z = 0; o.z < subdimensions; ++o.z, ++subdivision) {
-      VMesh::Timer t;
-      std::println("Subdivision: {}/{}", subdivision + 1, numSubdivisions);
+    // Palette every subdivision starts from. When voxelizing adds colours each subdivision grows its own copy, they're
+    // merged into the shared colours in subdivision order while attaching so the output doesn't depend on the jobs.
+    VMesh::Palette palette;
+    if (isTribox || isBinary) palette.addColour({1,1,1});
+    if (!isCreatePalette) palette.readFromFile(palettePath);
+    const bool isPaletteGrowing = isCreatePalette && !isBinary;
+    ColourPalette colours;
 
-      grid.clear();
-      glm::uvec3 origin(o.x * subdivisionSize, o.y * subdivisionSize, o.z * subdivisionSize);
-      grid.setOrigin(origin);
+    Octree parentSVO(resolution, isCreatePalette ? 255 : palette.size());
+    Tree64 parent64(resolution, isCreatePalette ? 255 : palette.size());
 
-      uint64_t trisComplete = 0;
-      std::future<void> f = startProgressBar(&grid.mDefaultLogMutex, "Voxelizing", &trisComplete, model.getTriCount());
+    std::optional<SubtreeSpill> spill;
+    if (vm.count("spill-dir")) spill.emplace(spillDirectory, resolution, subdivisionSize);
 
-      if (!isTribox) grid.DDAvoxelizeModel(model, reinterpret_cast<uint*>(&trisComplete), !isBinary, isCreatePalette, addColourDistance2);
-      else           grid.IntersectVoxelizeModel(model, reinterpret_cast<uint*>(&trisComplete));
+    // Keys start from everything besides the triangles that decides what a subdivision voxelizes to, the scale and
+    // translation are already in the transformed positions
+    std::optional<SubtreeCache> subtreeCache;
+    uint64_t cacheSeed = 0;
+    if (vm.count("subtree-cache")) {
+      subtreeCache.emplace(subtreeCacheDirectory);
+      cacheSeed = SubtreeCache::hashValues({resolution, subdivisionSize, uint64_t(isSparse ? 2 : isTribox ? 1 : 0), palette.size()});
+    }
 
-      temp = t.getTime();
-      totalVoxelizationTime += temp;
+    std::vector<std::optional<Octree>> subtrees(is64 || spill ? 0 : numSubdivisions);
+    std::vector<std::optional<Tree64>> subtrees64(is64 ? numSubdivisions : 0);
+    std::vector<std::vector<glm::vec3>> subdivisionColours(isPaletteGrowing ? numSubdivisions : 0);
+    std::atomic<uint> nextSubdivision = 0;
+    std::mutex timeMutex;
+    std::mutex stdoutMutex;
+    std::atomic<uint64_t> subdivisionsComplete = 0;
 
-      if (!grid.getVoxelCount()) {
-        f.wait();
-        std::println("Subdivision: {}/{} took {}", subdivision + 1, numSubdivisions, t.getTime());
-        continue;
-      }
+    auto generateSubdivisions = [&](uint pJob) {
+      const bool isQuiet = jobs > 1;
+      if (isQuiet) setTraceThreadName(std::format("job {}", pJob));
+      std::optional<GridPool::Lease> optionalGrid; // Only allocated once a subdivision has triangles
+
+      for (uint subdivision = nextSubdivision++; subdivision < numSubdivisions; subdivision = nextSubdivision++) {
+        if (bins && !bins->getTriCount(subdivision)) {
+          if (!isQuiet) std::println("Subdivision: {}/{} is empty", subdivision + 1, numSubdivisions);
+          else subdivisionsComplete.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
 
-      grid.setOrigin();
+        TRACE_SCOPE("subdivision", subdivision);
+        VMesh::Timer t;
+        const double cpuStart = Stats::getThreadCpuTime();
+        if (!isQuiet) std::println("Subdivision: {}/{}", subdivision + 1, numSubdivisions);
 
-      uint64_t completedCount = 0;
-      uint64_t total = grid.getMaxDepth() * grid.getVolume();
-      f = startProgressBar(&grid.mDefaultLogMutex, "Generating SVO", &completedCount, total);
-      Octree svo(grid, &completedCount);
+        const glm::uvec3 o(subdivision / (subdimensions * subdimensions), (subdivision / subdimensions) % subdimensions, subdivision % subdimensions);
+        glm::uvec3 origin = o * subdivisionSize;
+
+        ProgressBar f;
+        std::chrono::duration<double> voxelizationTime;
+        double voxelizationCpuTime;
+        uint64_t voxelCount, nodeCount = 0;
+        std::optional<Octree> svo;
+
+        uint64_t cacheKey = 0;
+        bool isCached = false;
+        uint splits = 0;
+        if (subtreeCache) {
+          const uint64_t seed = SubtreeCache::hashValues({subdivision}, cacheSeed);
+          cacheKey = bins ? SubtreeCache::hashTriangles(meshes, bins->getTriangles(subdivision), seed) : SubtreeCache::hashTriangles(meshes, seed);
+          Octree cached(subdivisionSize, palette.size());
+          isCached = subtreeCache->load(cacheKey, cached, voxelCount);
+          if (isCached && voxelCount) svo.emplace(std::move(cached));
+        }
+
+        if (isCached) {
+          voxelizationTime = t.getTime();
+          voxelizationCpuTime = Stats::getThreadCpuTime() - cpuStart;
+          if (!isQuiet) std::println("Subdivision: {}/{} is unchanged, read from the subtree cache", subdivision + 1, numSubdivisions);
+        }
+        else if (isRasterized) {
+          std::optional<SparseVoxels> voxels(std::in_place, subdivisionSize, origin);
+          if (subdivisionSize > MIN_SPLIT_SIZE) voxels->setMaxBytes(sparseBudget);
+          std::atomic<uint64_t> trisComplete = 0;
+          if (!isQuiet) f = startProgressBar(&stdoutMutex, "Voxelizing", &trisComplete, bins ? bins->getTriCount(subdivision) : triCount);
+          bool isWithinBudget;
+          if (bins) isWithinBudget = voxels->voxelizeTriangles(meshes, bins->getTriangles(subdivision), &trisComplete);
+          else      isWithinBudget = voxels->voxelizeMeshes(meshes, &trisComplete);
+          f.wait();
+
+          if (isWithinBudget) {
+            voxelizationTime = t.getTime();
+            voxelizationCpuTime = Stats::getThreadCpuTime() - cpuStart;
+            voxelCount = voxels->getVoxelCount();
+            if (voxelCount) svo.emplace(*voxels, palette.size());
+          }
+          else {
+            // Bricks went past the budget, rebuild it an octant at a time. Octants voxelize and build together so it's all voxelization time.
+            voxels.reset();
+            voxelCount = 0;
+            svo = buildSplitSparse(meshes, bins->getTriangles(subdivision), origin, subdivisionSize, palette.size(), sparseBudget, voxelCount, splits);
+            voxelizationTime = t.getTime();
+            voxelizationCpuTime = Stats::getThreadCpuTime() - cpuStart;
+            if (!isQuiet) std::println("Subdivision: {}/{} went over the memory budget, split {} times", subdivision + 1, numSubdivisions, splits);
+          }
+        }
+        else {
+          if (!optionalGrid) {
+            optionalGrid.emplace(pGridPool, subdivisionSize);
+            if (isVerbose) (*optionalGrid)->setLogStream(&std::cout);
+          }
+          VMesh::VoxelGrid& grid = **optionalGrid;
+          uint trisComplete = 0;
+
+          grid.clear();
+          grid.setOrigin(origin);
+          grid.mPalette = palette;
+
+          if (!isQuiet) f = startProgressBar(&grid.mDefaultLogMutex, "Voxelizing", &trisComplete, triCount);
+
+          {
+            TRACE_SCOPE("VoxelGrid::voxelize");
+            if (!isTribox) grid.DDAvoxelizeModel(model, &trisComplete, !isBinary, isCreatePalette, addColourDistance2);
+            else           grid.IntersectVoxelizeModel(model, &trisComplete);
+          }
+
+          f.wait();
+
+          voxelizationTime = t.getTime();
+          voxelizationCpuTime = Stats::getThreadCpuTime() - cpuStart;
+          voxelCount = grid.getVoxelCount();
+
+          if (voxelCount) {
+            grid.setOrigin();
+
+            std::atomic<uint64_t> completedCount = 0;
+            uint64_t total = grid.getVolume();
+            if (!isQuiet) f = startProgressBar(&grid.mDefaultLogMutex, is64 ? "Generating 64tree" : "Generating SVO", &completedCount, total);
+            if (is64) subtrees64[subdivision].emplace(grid, &completedCount);
+            else svo.emplace(grid, &completedCount, octreeJobs);
+            f.wait();
+
+            if (isPaletteGrowing) subdivisionColours[subdivision] = readColours(grid.mPalette).getColours();
+            if (is64) nodeCount = subtrees64[subdivision]->getNodeCount();
+          }
+        }
+
+        if (subtreeCache && !isCached) {
+          const Octree empty(subdivisionSize, palette.size());
+          subtreeCache->store(cacheKey, svo ? *svo : empty, voxelCount);
+        }
+        if (svo) {
+          nodeCount = svo->getNodeCount();
+          if (spill) spill->add(subdivision, *svo);
+          else subtrees[subdivision] = std::move(svo);
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(timeMutex);
+          totalVoxelizationTime += voxelizationTime;
+          totalOctreeGenerationTime += t.getTime() - voxelizationTime;
+          stats.mVoxels += voxelCount;
+          stats.mNodes += nodeCount;
+          stats.mCachedSubdivisions += isCached;
+          stats.mSplits += splits;
+        }
+        stats.addSubdivision({subdivision, voxelizationTime.count(), voxelizationCpuTime, (t.getTime() - voxelizationTime).count(), Stats::getThreadCpuTime() - cpuStart - voxelizationCpuTime,
+                              bins ? bins->getTriCount(subdivision) : triCount, voxelCount, nodeCount, isCached});
+
+        if (!isQuiet) std::println("Subdivision: {}/{} took {}", subdivision + 1, numSubdivisions, t.getTime());
+        else subdivisionsComplete.fetch_add(1, std::memory_order_relaxed);
+      }
+    };
+
+    Stats::Scope generateScope(stats, "generate");
+    if (jobs == 1) generateSubdivisions(0);
+    else {
+      std::println("Generating {} subdivisions with {} jobs", numSubdivisions, jobs);
+      ProgressBar f = startProgressBar(&stdoutMutex, "Subdivisions", &subdivisionsComplete, numSubdivisions);
+      std::vector<std::future<void>> workers;
+      for (uint i = 0; i < jobs; ++i)
+        workers.emplace_back(std::async(std::launch::async, generateSubdivisions, i));
+      for (std::future<void>& w : workers) w.get();
       f.wait();
-      parentSVO.attach(svo, origin);
+    }
+    generateScope.end();
+
+    // Attach and merge colours in subdivision order so the output doesn't depend on which job finished first
+    Stats::Scope attachScope(stats, "attach");
+    for (uint subdivision = 0; subdivision < numSubdivisions; ++subdivision) {
+      glm::uvec3 origin(subdivision / (subdimensions * subdimensions), (subdivision / subdimensions) % subdimensions, subdivision % subdimensions);
+      origin *= subdivisionSize;
 
-      totalOctreeGenerationTime += t.getTime() - temp;
+      // The subdivision's palette indices to shared ones, air stays 0
+      std::vector<uint32_t> paletteMap;
+      if (isPaletteGrowing && !subdivisionColours[subdivision].empty()) {
+        paletteMap.push_back(0);
+        for (const glm::vec3& colour : subdivisionColours[subdivision]) paletteMap.push_back(colours.addColour(colour, addColourDistance2) + 1);
+        subdivisionColours[subdivision] = {};
+      }
+
+      if (is64) {
+        if (!subtrees64[subdivision]) continue;
+        if (!paletteMap.empty()) subtrees64[subdivision]->remapPalette(paletteMap, 255);
+        parent64.attach(*subtrees64[subdivision], origin);
+        subtrees64[subdivision].reset();
+      }
+      else if (!spill) {
+        if (!subtrees[subdivision]) continue;
+        if (!paletteMap.empty()) subtrees[subdivision]->remapPalette(paletteMap, 255);
+        parentSVO.attach(*subtrees[subdivision], origin);
+        subtrees[subdivision].reset();
+      }
+      else if (!paletteMap.empty()) spill->remapPalette(subdivision, paletteMap, 255);
+    }
 
-      std::println("Subdivision: {}/{} took {}", subdivision + 1, numSubdivisions, t.getTime());
+    attachScope.end();
+
+    // Subdivisions that are all one value, or neighbours that match, leave nodes a single pass wouldn't have
+    if (!is64 && !spill && subdivisionlevel) {
+      Stats::Scope scope(stats, "collapse");
+      VMesh::Timer t;
+      stats.mCollapsedNodes = parentSVO.collapse();
+      std::println("Collapsing uniform subtrees removed {} nodes, took: {}", stats.mCollapsedNodes, t.getTime());
     }
+
+    if (is64) stats.mNodes = parent64.getNodeCount();
+    else if (!spill) stats.mNodes = parentSVO.getNodeCount();
+
     std::println("----------------------------------");
     std::println("Total voxelization time: {}", totalVoxelizationTime);
     std::println("Total octree generation time: {}", totalOctreeGenerationTime);
     std::println("----------------------------------");
 
-    if (isCreatePalette) {
-      std::println("palsize: {}", grid.mPalette.size());
-      if (grid.mPalette.size() > 255) throw std::runtime_error("Max palette size is 255, try increasing colour-distance");
-      parentSVO.resizePalette(grid.mPalette.size());
+    uint paletteSize = isPaletteGrowing ? colours.size() : palette.size();
+    if (isCreatePalette && isMedianCut) {
+      Stats::Scope scope(stats, "palette");
+      VMesh::Timer t;
+      parentSVO.resizePalette(colours.size());
+
+      std::vector<uint64_t> histogram = parentSVO.getPaletteHistogram();
+      ColourPalette reduced = ColourPalette::medianCut(colours.getColours(), std::vector<uint64_t>(histogram.begin() + 1, histogram.end()), 255);
+
+      std::vector<uint32_t> map(colours.size() + 1, 0);
+      for (uint i = 0; i < colours.size(); ++i)
+        if (histogram[i + 1]) map[i + 1] = reduced.findNearest(colours.getColour(i)) + 1; // Unused colours don't matter
+      parentSVO.remapPalette(map, reduced.size());
+      paletteSize = reduced.size();
+      stats.mNodes = parentSVO.getNodeCount();
+      std::println("Median cut {} colours to {} took: {}", colours.size(), paletteSize, t.getTime());
+
+      std::println("Writing pallete to: \e[1;3;4;33m{}\e[0m", paletteOut);
+      reduced.writeToFile(paletteOut);
+    }
+    else if (isCreatePalette) {
+      std::println("palsize: {}", paletteSize);
+      if (paletteSize > 255) throw std::runtime_error("Max palette size is 255, try increasing colour-distance or use --median-cut");
+      parentSVO.resizePalette(paletteSize);
+      parent64.resizePalette(paletteSize);
       std::println("Writing pallete to: \e[1;3;4;33m{}\e[0m", paletteOut);
-      grid.mPalette.writeToFile(paletteOut);
+      if (isPaletteGrowing) colours.writeToFile(paletteOut);
+      else palette.writeToFile(paletteOut);
     }
 
-    parentSVO.write(out);
+    stats.mPaletteSize = paletteSize;
+    {
+      Stats::Scope scope(stats, "write");
+      if (is64) parent64.write(out);
+      else if (spill) stats.mCollapsedNodes = spill->write(out, paletteSize);
+      else parentSVO.write(out, isDAG, layout, isCompact);
+    }
+    if (!is64 && !spill) writeLODs(parentSVO);
+    writeReports();
     
     std::println("Complete");
-    model.release();
+    if (isModelLoaded) model.release();
     return 0;
   }
 
   // Set log stream
-  VMesh::VoxelGrid voxelGrid(resolution);
+  GridPool::Lease voxelGridLease(pGridPool, resolution);
+  VMesh::VoxelGrid& voxelGrid = *voxelGridLease;
 
   if (isVerbose) voxelGrid.setLogStream(&std::cout);
   if (isTribox || isBinary) voxelGrid.mPalette.addColour({1,1,1});
   if (!isCreatePalette) voxelGrid.mPalette.readFromFile(palettePath);
 
   // Voxelize
-  uint64_t trisComplete = 0;
-  std::future<void> f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Voxelizing", &trisComplete, model.getTriCount());
-  if (!isTribox) voxelGrid.DDAvoxelizeModel(model, reinterpret_cast<uint*>(&trisComplete), !isBinary, isCreatePalette, addColourDistance2);
-  else voxelGrid.IntersectVoxelizeModel(model, reinterpret_cast<uint*>(&trisComplete));
-
+  uint trisComplete = 0;
+  Stats::Scope voxelizeScope(stats, "voxelize");
+  ProgressBar f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Voxelizing", &trisComplete, triCount);
+  if (!isTribox) voxelGrid.DDAvoxelizeModel(model, &trisComplete, !isBinary, isCreatePalette, addColourDistance2);
+  else voxelGrid.IntersectVoxelizeModel(model, &trisComplete);
   f.wait();
+  voxelizeScope.end();
+  stats.mVoxels = voxelGrid.getVoxelCount();
+  stats.mPaletteSize = voxelGrid.mPalette.size();
 
   if (isCreatePalette) {
     std::println("Writing pallete to: \e[1;3;4;33m{}\e[0m", paletteOut);
     voxelGrid.mPalette.writeToFile(paletteOut);
   }
 
-  if (outputFormat == "vmu") voxelGrid.writeToFile(out);
-  else {
-    uint64_t voxelsComplete = 0;
-    std::future<void> f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Compressing", &voxelsComplete, voxelGrid.getVolume());
-    voxelGrid.writeToFileCompressed(out, &voxelsComplete);
+  {
+    Stats::Scope scope(stats, "write");
+    if (outputFormat == "vmu") voxelGrid.writeToFile(out);
+    else {
+      uint64_t voxelsComplete = 0;
+      ProgressBar f = startProgressBar(&voxelGrid.mDefaultLogMutex, "Compressing", &voxelsComplete, voxelGrid.getVolume());
+      voxelGrid.writeToFileCompressed(out, &voxelsComplete);
+      f.wait();
+    }
   }
+  writeReports();
 
   std::println("Complete");
   model.release();
   return 0;
 }
 
+// Splits a manifest line into arguments on whitespace, double quotes group an argument with spaces
+static std::vector<std::string> splitArguments(const std::string& pLine) {
+  std::vector<std::string> args;
+  std::string arg;
+  bool isQuoted = false, isArg = false;
+  for (char c : pLine) {
+    if (!isQuoted && std::isspace(uint8_t(c))) {
+      if (isArg) args.push_back(arg);
+      arg.clear();
+      isArg = false;
+      continue;
+    }
+    if (c == '"') isQuoted = !isQuoted;
+    else arg += c;
+    isArg = true;
+  }
+  if (isArg) args.push_back(arg);
+  return args;
+}
+
+static int batch(int argc, char** argv) {
+  uint jobs;
+  bool isNoProgress;
+  std::string manifestPath, palettePath, tracePath, poolMemoryStr;
+
+  po::options_description visibleOptions("Options", 100, 40);
+  visibleOptions.add_options()
+    ("help,h", "produce help message")
+    ("jobs,j", po::value<uint>(&jobs)->default_value(1), "set number of manifest jobs to run at the same time")
+    ("palette,P", po::value<std::string>(&palettePath), "use this palette for every job that doesn't specify its own")
+    ("no-progress", po::bool_switch(&isNoProgress), "don't draw progress bars, they're always left out when running more than one job at a time")
+    ("trace", po::value<std::string>(&tracePath), "write a chrome trace of the whole batch to this json file, each job's zones are under a zone named after its manifest line")
+    ("pool-memory", po::value<std::string>(&poolMemoryStr)->default_value("1G"), "keep voxel grids of finished jobs for later ones until they take more than this many bytes, K, M, G and T suffixes are powers of 1024, the least recently used are freed first")
+  ;
+
+  po::options_description hiddenOptions("Hidden");
+  hiddenOptions.add_options()
+    ("manifest", po::value<std::string>(&manifestPath), "manifest file path")
+  ;
+
+  po::positional_options_description p;
+  p.add("manifest", 1);
+
+  po::options_description options("Options", 100, 40);
+  options.add(visibleOptions).add(hiddenOptions);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(options).positional(p).run(), vm);
+  }
+  catch (boost::wrapexcept<po::invalid_option_value>& pErr) {
+    std::println("{}, use -h for help", pErr.what());
+    return 1;
+  }
+  catch (boost::wrapexcept<po::unknown_option>& pErr) {
+    std::println("{}, use -h for help", pErr.what());
+    return 1;
+  }
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::println("Usage: vmesh --batch manifest-path OPTIONS\n\nRun every line of the manifest as its own vmesh command in one process, a line is input-path output-path(optional) followed by any vmesh options\n");
+    std::cout << visibleOptions;
+    return 0;
+  }
+
+  if (!vm.count("manifest")) {
+    std::println("Missing manifest file path, use -h for help");
+    return 1;
+  }
+
+  if (!jobs) {
+    std::println("Jobs has to be at least 1");
+    return 1;
+  }
+
+  uint64_t poolMemory;
+  if (!MemoryBudget::parseBytes(poolMemoryStr, poolMemory)) {
+    std::println("Invalid pool memory, use -h for help");
+    return 1;
+  }
+
+  struct Job {
+    uint line;
+    std::vector<std::string> args;
+    std::string error;
+    bool isExclusive; // Runs on its own so the process wide cpu time and peak memory in its stats are only its own
+  };
+  std::vector<Job> batchJobs;
+  {
+    std::ifstream fin;
+    fin.open(manifestPath, std::ios::in);
+    if (!fin.is_open()) {
+      std::println("Could not open manifest file");
+      return 1;
+    }
+    std::string line;
+    for (uint lineNumber = 1; std::getline(fin, line); ++lineNumber) {
+      std::vector<std::string> args = splitArguments(line);
+      if (args.empty() || args[0][0] == '#') continue;
+
+      const bool hasPalette = std::any_of(args.begin(), args.end(), [](const std::string& pArg) { return pArg == "-P" || pArg.starts_with("--palette"); });
+      const bool hasStats = std::any_of(args.begin(), args.end(), [](const std::string& pArg) { return pArg.starts_with("--stats-json"); });
+      if (!palettePath.empty() && !hasPalette) args.insert(args.end(), {"--palette", palettePath});
+      args.insert(args.begin(), "vmesh");
+      batchJobs.push_back({lineNumber, std::move(args), "", hasStats});
+    }
+  }
+
+  jobs = std::min<uint>(jobs, std::max<size_t>(batchJobs.size(), 1));
+  if (isNoProgress || jobs > 1 || !isatty(STDOUT_FILENO)) setProgressBarsEnabled(false);
+  std::println("Running {} jobs from {} with {} at a time", batchJobs.size(), manifestPath, jobs);
+
+  if (vm.count("trace")) {
+#ifndef _PROFILING
+    std::println("Tracing needs a build with _PROFILING defined");
+    return 1;
+#endif
+    startTrace();
+  }
+
+  GridPool gridPool(poolMemory);
+  std::atomic<uint> nextJob = 0;
+  std::shared_mutex exclusiveMutex;
+  VMesh::Timer t;
+
+  auto runJobs = [&](uint pWorker) {
+    setTraceThreadName(std::format("batch {}", pWorker));
+    for (uint i = nextJob++; i < batchJobs.size(); i = nextJob++) {
+      Job& job = batchJobs[i];
+      std::vector<char*> argv;
+      for (std::string& arg : job.args) argv.push_back(arg.data());
+      argv.push_back(nullptr);
+
+      std::shared_lock<std::shared_mutex> sharedLock(exclusiveMutex, std::defer_lock);
+      std::unique_lock<std::shared_mutex> exclusiveLock(exclusiveMutex, std::defer_lock);
+      if (job.isExclusive) exclusiveLock.lock();
+      else sharedLock.lock();
+
+      TRACE_SCOPE("job", job.line);
+      try {
+        if (convert(argv.size() - 1, argv.data(), &gridPool)) job.error = "invalid options";
+      }
+      catch (std::exception& pErr) {
+        job.error = pErr.what();
+      }
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  for (uint i = 1; i < jobs; ++i)
+    workers.emplace_back(std::async(std::launch::async, runJobs, i));
+  runJobs(0);
+  for (std::future<void>& w : workers) w.get();
+
+  if (!tracePath.empty()) {
+    std::println("Writing trace to: \e[1;3;4;33m{}\e[0m", tracePath);
+    writeTrace(tracePath);
+  }
+
+  uint failedCount = 0;
+  for (const Job& job : batchJobs) {
+    if (job.error.empty()) continue;
+    std::println("{}:{}: {} failed: {}", manifestPath, job.line, job.args.size() > 1 ? job.args[1] : "", job.error);
+    ++failedCount;
+  }
+  std::println("{}/{} jobs succeeded in {}", batchJobs.size() - failedCount, batchJobs.size(), t.getTime());
+  return failedCount ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "query") return query(argc - 1, argv + 1);
+  if (argc > 1 && std::string(argv[1]) == "--batch") return batch(argc - 1, argv + 1);
+  return convert(argc, argv);
+}
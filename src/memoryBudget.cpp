@@ -0,0 +1,116 @@
+#include "memoryBudget.hpp"
+#include "triangleBins.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <limits>
+
+MemoryBudget::MemoryBudget(uint64_t pMaxBytes, uint pResolution, std::span<const MeshView> pMeshes, bool pIsSparse, bool pIsSpilled)
+:mMaxBytes(pMaxBytes), mResolution(pResolution), mIsSparse(pIsSparse), mIsSpilled(pIsSpilled) {
+  double area = 0;
+  for (const MeshView& m : pMeshes) {
+    for (uint64_t j = 0; j + 2 < m.indexCount; j += 3) {
+      const glm::vec3 a = m.getPosition(m.indices[j]);
+      area += 0.5 * glm::length(glm::cross(m.getPosition(m.indices[j + 1]) - a, m.getPosition(m.indices[j + 2]) - a));
+    }
+    // Closed meshes have about half a vertex per triangle
+    mTriangles += m.indexCount / 3;
+    mMeshBytes += m.indexCount * sizeof(uint32_t) + m.indexCount / 6 * m.stride;
+  }
+  const double volume = double(pResolution) * pResolution * pResolution;
+  mSurfaceVoxels = std::min(area * SURFACE_VOXELS_PER_AREA, volume);
+}
+
+uint64_t MemoryBudget::getSharedBytes(uint pSubdivisionLevel) const {
+  uint64_t bytes = mMeshBytes;
+  // Triangles crossing a boundary are binned more than once
+  if (pSubdivisionLevel) bytes += mTriangles * sizeof(TriangleRef) * 5 / 4 + uint64_t(std::min(std::ldexp(double(sizeof(uint64_t)), 3 * pSubdivisionLevel), 1e18));
+  // The octree and the indices generated from it when writing, spilled subtrees are on disk instead
+  if (!mIsSpilled) bytes += 2 * uint64_t(mSurfaceVoxels / SURFACE_VOXELS_PER_NODE) * NODE_BYTES;
+  return bytes;
+}
+
+uint64_t MemoryBudget::getJobBytes(uint pSubdivisionLevel) const {
+  const double voxels = getSubdivisionVoxels(pSubdivisionLevel);
+  uint64_t bytes = uint64_t(voxels / SURFACE_VOXELS_PER_NODE) * NODE_BYTES;
+  if (mIsSparse) bytes += uint64_t(voxels / SURFACE_VOXELS_PER_BRICK) * BRICK_BYTES;
+  else {
+    const uint64_t size = mResolution >> pSubdivisionLevel;
+    bytes += size * size * size * GRID_BYTES_PER_VOXEL + PALETTE_BYTES;
+  }
+  return bytes;
+}
+
+uint64_t MemoryBudget::estimate(uint pSubdivisionLevel, uint pJobs) const {
+  return getSharedBytes(pSubdivisionLevel) + pJobs * getJobBytes(pSubdivisionLevel);
+}
+
+bool MemoryBudget::plan(uint pMinLevel, uint pMaxLevel, uint pLevelStep, uint pMinJobs, uint pMaxJobs, uint& pSubdivisionLevel, uint& pJobs) const {
+  pSubdivisionLevel = pMinLevel;
+  pJobs = pMinJobs;
+  uint64_t smallest = std::numeric_limits<uint64_t>::max();
+  bool isFitting = false;
+  for (uint level = pMinLevel; level <= pMaxLevel; level += pLevelStep) {
+    const uint64_t bytes = estimate(level, pMinJobs);
+    if (bytes < smallest) {
+      smallest = bytes;
+      pSubdivisionLevel = level;
+    }
+    if (bytes <= mMaxBytes) {
+      pSubdivisionLevel = level;
+      isFitting = true;
+      break;
+    }
+  }
+
+  // More jobs than subdivisions would sit idle
+  const uint64_t numSubdivisions = uint64_t(1) << std::min(3 * pSubdivisionLevel, 63u);
+  const uint maxJobs = std::min<uint64_t>(pMaxJobs, numSubdivisions);
+  while (isFitting && pJobs < maxJobs && estimate(pSubdivisionLevel, pJobs + 1) <= mMaxBytes) ++pJobs;
+  return isFitting;
+}
+
+uint64_t MemoryBudget::getSparseBudget(uint pSubdivisionLevel, uint pJobs) const {
+  const uint64_t shared = getSharedBytes(pSubdivisionLevel);
+  const uint64_t left = mMaxBytes > shared ? mMaxBytes - shared : 0;
+  // Half of each job's share, the subtree built from the bricks needs the rest
+  return std::max<uint64_t>(left / pJobs / 2, sizeof(Brick));
+}
+
+uint64_t MemoryBudget::getMaxBytes() const {
+  return mMaxBytes;
+}
+
+uint64_t MemoryBudget::getSurfaceVoxels() const {
+  return mSurfaceVoxels;
+}
+
+bool MemoryBudget::parseBytes(const std::string& pStr, uint64_t& pBytes) {
+  size_t end = 0;
+  double value;
+  try {
+    value = std::stod(pStr, &end);
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  if (value <= 0) return false;
+
+  std::string suffix = pStr.substr(end);
+  for (char& c : suffix) c = std::toupper(c);
+  if (suffix.ends_with("IB")) suffix.erase(suffix.size() - 2);
+  else if (suffix.ends_with("B")) suffix.pop_back();
+
+  const std::string units = "KMGT";
+  uint shift = 0;
+  if (suffix.size() == 1 && units.find(suffix[0]) != std::string::npos) shift = (units.find(suffix[0]) + 1) * 10;
+  else if (!suffix.empty()) return false;
+
+  pBytes = value * double(uint64_t(1) << shift);
+  return pBytes != 0;
+}
+
+double MemoryBudget::getSubdivisionVoxels(uint pSubdivisionLevel) const {
+  const double size = mResolution >> pSubdivisionLevel;
+  return std::min(mSurfaceVoxels / std::pow(4.0, pSubdivisionLevel), size * size * size);
+}
@@ -0,0 +1,240 @@
+#include "meshCache.hpp"
+#include "trace.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <format>
+#include <stdexcept>
+#include <cstring>
+#include <limits>
+#include <chrono>
+#include <thread>
+
+std::vector<MeshView> getMeshViews(VMesh::Model& pModel) {
+  std::vector<MeshView> meshes;
+  for (uint i = 0; i < pModel.getNumMeshes(); ++i) {
+    VMesh::Mesh& m = pModel.getMesh(i);
+    const std::vector<VMesh::Vertex>& meshVertices = m.getVertices();
+    const std::vector<uint>& meshIndices = m.getIndices();
+    meshes.push_back({meshVertices.empty() ? nullptr : reinterpret_cast<const uint8_t*>(&meshVertices[0].pos), sizeof(VMesh::Vertex), meshIndices.data(), meshIndices.size()});
+  }
+  return meshes;
+}
+
+void getMeshBounds(std::span<const MeshView> pMeshes, glm::vec3& pSmallest, glm::vec3& pLargest) {
+  pSmallest = glm::vec3(std::numeric_limits<float>::infinity());
+  pLargest = glm::vec3(-std::numeric_limits<float>::infinity());
+  for (const MeshView& m : pMeshes) {
+    for (uint64_t j = 0; j < m.indexCount; ++j) {
+      const glm::vec3& v = m.getPosition(m.indices[j]);
+      pSmallest = glm::min(pSmallest, v);
+      pLargest = glm::max(pLargest, v);
+    }
+  }
+}
+
+glm::mat4 getFitMatrix(const glm::vec3& pSmallest, const glm::vec3& pLargest, uint pResolution, const std::string& pScaleMode) {
+  glm::mat4 m(1.0f);
+  if (pScaleMode == "stretch")
+    m = glm::scale(m, glm::vec3(pResolution-1, pResolution-1, pResolution-1) / (pLargest + (glm::vec3(0, 0, 0) - pSmallest)) );
+  else if (pScaleMode == "proportional") {
+    glm::vec3 vec(glm::vec3(pResolution-1, pResolution-1, pResolution-1) / (pLargest + (glm::vec3(0, 0, 0) - pSmallest)));
+    float v = std::min(vec.x, std::min(vec.y, vec.z));
+    m = glm::scale(m,  glm::vec3(v, v, v));
+  }
+  return glm::translate(m, glm::vec3(0, 0, 0) - pSmallest);
+}
+
+MeshCache::~MeshCache() {
+  close();
+}
+
+std::string MeshCache::getPath(const std::string& pDirectory, const std::string& pModelPath) {
+  // FNV-1a of the absolute path, the path itself is checked when the cache is opened
+  const std::string path = std::filesystem::absolute(pModelPath).lexically_normal().string();
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : path) hash = (hash ^ uint8_t(c)) * 0x100000001b3;
+  return (std::filesystem::path(pDirectory) / std::format("{:016x}.vmcache", hash)).string();
+}
+
+void MeshCache::write(const std::string& pPath, const std::string& pModelPath, std::span<const MeshView> pMeshes, const glm::vec3& pSmallest, const glm::vec3& pLargest) {
+  TRACE_SCOPE("MeshCache::write");
+  Header header{};
+  std::string path;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  if (!getModelKey(pModelPath, path, header.modelSize, header.modelModified)) throw std::runtime_error("Could not stat model file");
+  header.pathSize = path.size();
+  header.meshCount = pMeshes.size();
+  header.smallest = pSmallest;
+  header.largest = pLargest;
+
+  // Vertices a mesh's indices use, VMesh meshes don't say how many vertices they have apart from this
+  std::vector<uint64_t> counts;
+  for (const MeshView& m : pMeshes) {
+    uint64_t vertexCount = 0;
+    for (uint64_t j = 0; j < m.indexCount; ++j) vertexCount = std::max<uint64_t>(vertexCount, m.indices[j] + 1);
+    counts.push_back(vertexCount);
+    counts.push_back(m.indexCount);
+  }
+
+  // Written next to the cache then renamed over it so batch jobs sharing a directory never map half a file. Batch jobs
+  // are threads of one process so the temporary name needs the thread as well as the pid.
+  std::filesystem::create_directories(std::filesystem::path(pPath).parent_path());
+  const std::string tempPath = std::format("{}.{}-{:x}.tmp", pPath, getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::ofstream fout;
+  fout.open(tempPath, std::ios::out | std::ios::binary);
+  if (!fout.is_open()) throw std::runtime_error("Could not open mesh cache file");
+
+  fout.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  path.resize(getPathSize(header.pathSize), '\0');
+  fout.write(path.data(), path.size());
+  fout.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint64_t));
+  for (uint i = 0; i < pMeshes.size(); ++i)
+    for (uint64_t j = 0; j < counts[i * 2]; ++j) fout.write(reinterpret_cast<const char*>(&pMeshes[i].getPosition(j)), sizeof(glm::vec3));
+  for (const MeshView& m : pMeshes) fout.write(reinterpret_cast<const char*>(m.indices), m.indexCount * sizeof(uint32_t));
+
+  fout.close();
+  if (fout.fail()) {
+    std::filesystem::remove(tempPath);
+    throw std::runtime_error("Could not write mesh cache file");
+  }
+  std::filesystem::rename(tempPath, pPath);
+}
+
+bool MeshCache::open(const std::string& pPath, const std::string& pModelPath) {
+  TRACE_SCOPE("MeshCache::open");
+  close();
+
+  std::string path;
+  uint64_t modelSize;
+  int64_t modelModified;
+  if (!getModelKey(pModelPath, path, modelSize, modelModified)) return false;
+
+  const int file = ::open(pPath.c_str(), O_RDONLY);
+  if (file == -1) return false;
+  struct stat st;
+  if (fstat(file, &st) == -1 || size_t(st.st_size) < sizeof(Header)) {
+    ::close(file);
+    return false;
+  }
+  mSize = st.st_size;
+
+  // Private and writable so transform only copies the pages it changes
+  mData = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+  ::close(file);
+  if (mData == MAP_FAILED) {
+    mData = nullptr;
+    return false;
+  }
+  madvise(mData, mSize, MADV_SEQUENTIAL);
+
+  uint8_t* data = static_cast<uint8_t*>(mData);
+  Header header;
+  std::memcpy(&header, data, sizeof(Header));
+  uint64_t offset = sizeof(Header) + getPathSize(header.pathSize);
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION || header.modelSize != modelSize || header.modelModified != modelModified
+      || offset + uint64_t(header.meshCount) * 2 * sizeof(uint64_t) > mSize || path != std::string_view(reinterpret_cast<const char*>(data + sizeof(Header)), header.pathSize)) {
+    close();
+    return false;
+  }
+
+  mVertexCounts.resize(header.meshCount);
+  mIndexCounts.resize(header.meshCount);
+  for (uint i = 0; i < header.meshCount; ++i) {
+    std::memcpy(&mVertexCounts[i], data + offset, sizeof(uint64_t));
+    std::memcpy(&mIndexCounts[i], data + offset + sizeof(uint64_t), sizeof(uint64_t));
+    offset += 2 * sizeof(uint64_t);
+    if (mVertexCounts[i] > mSize / sizeof(glm::vec3) || mIndexCounts[i] > mSize / sizeof(uint32_t)) {
+      close();
+      return false;
+    }
+  }
+  for (uint i = 0; i < header.meshCount; ++i) {
+    mPositions.push_back(reinterpret_cast<glm::vec3*>(data + offset));
+    offset += mVertexCounts[i] * sizeof(glm::vec3);
+  }
+  for (uint i = 0; i < header.meshCount; ++i) {
+    mIndices.push_back(reinterpret_cast<const uint32_t*>(data + offset));
+    offset += mIndexCounts[i] * sizeof(uint32_t);
+  }
+  if (offset != mSize) {
+    close();
+    return false;
+  }
+
+  // Indices are used to read positions straight out of the mapping, one past a mesh's vertices would read outside it
+  for (uint i = 0; i < header.meshCount; ++i) {
+    for (uint64_t j = 0; j < mIndexCounts[i]; ++j) {
+      if (mIndices[i][j] >= mVertexCounts[i]) {
+        close();
+        return false;
+      }
+    }
+  }
+
+  mSmallest = header.smallest;
+  mLargest = header.largest;
+  return true;
+}
+
+void MeshCache::transform(const glm::mat4& pMatrix) {
+  TRACE_SCOPE("MeshCache::transform");
+  for (uint i = 0; i < mPositions.size(); ++i)
+    for (uint64_t j = 0; j < mVertexCounts[i]; ++j) mPositions[i][j] = glm::vec3(pMatrix * glm::vec4(mPositions[i][j], 1.0f));
+}
+
+std::vector<MeshView> MeshCache::getMeshViews() const {
+  std::vector<MeshView> meshes;
+  for (uint i = 0; i < mPositions.size(); ++i)
+    meshes.push_back({reinterpret_cast<const uint8_t*>(mPositions[i]), sizeof(glm::vec3), mIndices[i], mIndexCounts[i]});
+  return meshes;
+}
+
+uint MeshCache::getNumMeshes() const {
+  return mPositions.size();
+}
+
+uint64_t MeshCache::getTriCount() const {
+  uint64_t count = 0;
+  for (uint64_t indexCount : mIndexCounts) count += indexCount / 3;
+  return count;
+}
+
+const glm::vec3& MeshCache::getSmallest() const {
+  return mSmallest;
+}
+
+const glm::vec3& MeshCache::getLargest() const {
+  return mLargest;
+}
+
+bool MeshCache::getModelKey(const std::string& pModelPath, std::string& pAbsolutePath, uint64_t& pSize, int64_t& pModified) {
+  std::error_code err;
+  const std::filesystem::path path = std::filesystem::absolute(pModelPath, err).lexically_normal();
+  pSize = std::filesystem::file_size(path, err);
+  if (err) return false;
+  pModified = std::chrono::duration_cast<std::chrono::nanoseconds>(std::filesystem::last_write_time(path, err).time_since_epoch()).count();
+  if (err) return false;
+  pAbsolutePath = path.string();
+  return true;
+}
+
+uint64_t MeshCache::getPathSize(uint32_t pSize) {
+  return (uint64_t(pSize) + 7) & ~uint64_t(7);
+}
+
+void MeshCache::close() {
+  if (mData) munmap(mData, mSize);
+  mData = nullptr;
+  mSize = 0;
+  mPositions.clear();
+  mIndices.clear();
+  mVertexCounts.clear();
+  mIndexCounts.clear();
+}
@@ -1,119 +1,556 @@
 #include <octree.hpp>
+#include <trace.hpp>
+#include <compactIndices.hpp>
+
+#include <future>
 
 Octree::Octree(uint pResolution, uint pPaletteSize)
-:mResolution(pResolution) {
-  // Init palette
-  for (uint i = 0; i <= pPaletteSize; ++i)
-    mPalette.emplace_back(std::make_shared<Node>(std::numeric_limits<uint32_t>::max() - pPaletteSize + i));
+:mResolution(pResolution), mPaletteSize(pPaletteSize) {}
+
+template<class F>
+uint32_t Octree::buildDense(uint pResolution, F&& pBlock, std::vector<std::array<uint32_t, 8>>& pNodes, std::atomic<uint64_t>* pCompletedCount) {
+  // Scan 2x2x2 blocks in morton order, every 8 consecutive blocks are siblings so each level only needs
+  // the children of the node currently being built. Uniform groups collapse straight into a palette leaf.
+  const uint depth = std::countr_zero(pResolution);
+  std::vector<std::array<uint32_t, 8>> levels(depth + 1);
+  std::vector<uint8_t> levelSizes(depth + 1, 0);
+
+  auto push = [&](uint pLevel, uint32_t pHandle) {
+    levels[pLevel][levelSizes[pLevel]++] = pHandle;
+    while (pLevel < depth && levelSizes[pLevel] == 8) {
+      const std::array<uint32_t, 8>& children = levels[pLevel];
+      levelSizes[pLevel] = 0;
+      bool isUniform = isLeaf(children[0]); // Only leaves can be equal, nodes are unique
+      for (uint i = 1; i < 8 && isUniform; ++i) isUniform = children[i] == children[0];
+      uint32_t h = children[0];
+      if (!isUniform) {
+        h = pNodes.size();
+        pNodes.push_back(children);
+      }
+      ++pLevel;
+      levels[pLevel][levelSizes[pLevel]++] = h;
+    }
+  };
+
+  const uint64_t blockCount = uint64_t(pResolution) * pResolution * pResolution >> 3;
+  for (uint64_t block = 0; block < blockCount; ++block) {
+    std::array<uint32_t, 8> voxels;
+    pBlock(block, voxels);
+
+    bool isUniform = true;
+    for (uint i = 1; i < 8 && isUniform; ++i) isUniform = voxels[i] == voxels[0];
+    if (isUniform) push(1, voxels[0]);
+    else {
+      pNodes.push_back(voxels);
+      push(1, pNodes.size() - 1);
+    }
+    if (pCompletedCount && (block + 1) % PROGRESS_BATCH == 0) pCompletedCount->fetch_add(PROGRESS_BATCH * 8, std::memory_order_relaxed);
+  }
+  if (pCompletedCount) pCompletedCount->fetch_add(blockCount % PROGRESS_BATCH * 8, std::memory_order_relaxed);
+
+  return levels[depth][0];
 }
 
-Octree::Octree(VMesh::VoxelGrid& pGrid, uint64_t* pCompletedCount) {
+Octree::Octree(VMesh::VoxelGrid& pGrid, std::atomic<uint64_t>* pCompletedCount, uint pJobs)
+:mPaletteSize(pGrid.mPalette.size()) {
+  TRACE_SCOPE("Octree::Octree");
   for (mResolution = 1; mResolution < pGrid.getResolution(); mResolution <<= 1) {}
 
-  uint64_t completedCount;
-  if (!pCompletedCount)
-    pCompletedCount = &completedCount;
+  const uint64_t volume = uint64_t(mResolution) * mResolution * mResolution;
+  const uint gridResolution = pGrid.getResolution();
+
+  if (pGrid.getVoxelCount() == 0 || mResolution == 1) {
+    mRoot = toLeaf(pGrid.queryVoxelData(glm::uvec3(0)));
+    if (pCompletedCount) pCompletedCount->fetch_add(volume, std::memory_order_relaxed);
+    return;
+  }
+
+  // Blocks of a region, the whole grid is a single region at the origin
+  auto buildRegion = [&](uint pSize, const glm::uvec3& pOrigin, std::vector<std::array<uint32_t, 8>>& pNodes) {
+    return buildDense(pSize, [&](uint64_t pBlock, std::array<uint32_t, 8>& pVoxels) {
+      const glm::uvec3 origin = pOrigin + fromMorton(pBlock) * 2u;
+      for (uint8_t i = 0; i < 8; ++i) {
+        const glm::uvec3 pos = origin + toChildPos(i);
+        pVoxels[i] = toLeaf(pos.x < gridResolution && pos.y < gridResolution && pos.z < gridResolution ? pGrid.queryVoxelData(pos) : 0);
+      }
+    }, pNodes, pCompletedCount);
+  };
+
+  // Regions have to be at least 2 voxels wide
+  const uint splitDepth = std::min<uint>(PARALLEL_SPLIT_DEPTH, std::countr_zero(mResolution) - 1);
+  if (pJobs <= 1 || !splitDepth) {
+    mRoot = buildRegion(mResolution, glm::uvec3(0), mNodes);
+    return;
+  }
 
-  // Init palette
-  for (uint i = 0; i <= pGrid.mPalette.size(); ++i)
-    mPalette.emplace_back(std::make_shared<Node>(std::numeric_limits<uint32_t>::max() - pGrid.mPalette.size() + i));
+  // Regions are the nodes splitDepth levels down, numbered in morton order, built by jobs taking the next unbuilt one
+  const uint regionCount = 1u << (3 * splitDepth);
+  const uint regionSize = mResolution >> splitDepth;
+  std::vector<std::vector<std::array<uint32_t, 8>>> regionNodes(regionCount);
+  std::vector<uint32_t> regionRoots(regionCount);
+  std::atomic<uint> nextRegion = 0;
+  auto buildRegions = [&]() {
+    for (uint r = nextRegion++; r < regionCount; r = nextRegion++) {
+      TRACE_SCOPE("Octree region", r);
+      regionRoots[r] = buildRegion(regionSize, fromMorton(r) * regionSize, regionNodes[r]);
+    }
+  };
+  std::vector<std::future<void>> workers;
+  for (uint i = 0; i < std::min(pJobs, regionCount); ++i)
+    workers.emplace_back(std::async(std::launch::async, buildRegions));
+  for (std::future<void>& w : workers) w.get();
 
-  if (pGrid.getVoxelCount() == 0 || (pGrid.getVoxelCount() == pGrid.getVolume() && pGrid.isRegionAllSame(glm::uvec3(0), mResolution)) ) {
-    mNodes.emplace_back(mPalette.at(pGrid.queryVoxelData(glm::uvec3(0))));
-    *pCompletedCount += std::log2(mResolution) * pGrid.getVolume();
+  // Link regions in order like attach does, then collapse the levels above them
+  std::vector<uint32_t> handles(regionCount);
+  for (uint r = 0; r < regionCount; ++r) {
+    const uint32_t offset = mNodes.size();
+    for (std::array<uint32_t, 8>& node : regionNodes[r]) {
+      for (uint32_t& child : node)
+        if (!isLeaf(child)) child += offset;
+      mNodes.push_back(node);
+    }
+    std::vector<std::array<uint32_t, 8>>().swap(regionNodes[r]);
+    handles[r] = isLeaf(regionRoots[r]) ? regionRoots[r] : regionRoots[r] + offset;
+  }
+  while (handles.size() > 1) {
+    std::vector<uint32_t> parents(handles.size() / 8);
+    for (size_t i = 0; i < parents.size(); ++i) {
+      std::array<uint32_t, 8> children;
+      std::copy_n(handles.begin() + i * 8, 8, children.begin());
+      bool isUniform = isLeaf(children[0]);
+      for (uint j = 1; j < 8 && isUniform; ++j) isUniform = children[j] == children[0];
+      parents[i] = children[0];
+      if (!isUniform) {
+        parents[i] = mNodes.size();
+        mNodes.push_back(children);
+      }
+    }
+    handles = std::move(parents);
+  }
+  mRoot = handles[0];
+}
+
+Octree::Octree(std::span<const uint8_t> pVoxels, uint pResolution, uint pPaletteSize)
+:mResolution(pResolution), mPaletteSize(pPaletteSize) {
+  TRACE_SCOPE("Octree::Octree morton");
+  if (pVoxels.size() != uint64_t(mResolution) * mResolution * mResolution) throw std::runtime_error("Voxel count doesn't match the resolution");
+  if (mResolution == 1) {
+    mRoot = toLeaf(pVoxels[0]);
     return;
   }
 
-  *pCompletedCount += pGrid.getVolume();
-  
-  std::vector<std::tuple<uint, glm::uvec3, uint>> queue;
+  // In morton order each block is 8 consecutive voxels in child index order
+  mRoot = buildDense(mResolution, [&](uint64_t pBlock, std::array<uint32_t, 8>& pBlockVoxels) {
+    for (uint8_t i = 0; i < 8; ++i) pBlockVoxels[i] = toLeaf(pVoxels[pBlock * 8 + i]);
+  }, mNodes, NULL);
+}
 
-  mNodes.emplace_back(std::make_shared<Node>());
-  for (uint8_t i = 0; i < 8; ++i) queue.push_back({i, toChildPos(i) * (mResolution >> 1), mResolution >> 1});
+Octree::Octree(SparseVoxels& pVoxels, uint pPaletteSize)
+:mPaletteSize(pPaletteSize) {
+  TRACE_SCOPE("Octree::Octree sparse");
+  for (mResolution = 1; mResolution < pVoxels.getResolution(); mResolution <<= 1) {}
 
-  for (uint i = 0; i < queue.size(); ++i) {
-    uint               index = std::get<0>(queue.at(i));
-    const glm::uvec3  origin = std::get<1>(queue.at(i));
-    uint                size = std::get<2>(queue.at(i));
+  const std::vector<Brick>& bricks = pVoxels.getBricks();
+  if (bricks.empty()) return;
+  const uint32_t air = toLeaf(0), solid = toLeaf(1);
+
+  auto collapse = [&](const std::array<uint32_t, 8>& pChildren) -> uint32_t {
+    bool isUniform = isLeaf(pChildren[0]);
+    for (uint i = 1; i < 8 && isUniform; ++i) isUniform = pChildren[i] == pChildren[0];
+    if (isUniform) return pChildren[0];
+    mNodes.push_back(pChildren);
+    return mNodes.size() - 1;
+  };
 
-    if (pGrid.isRegionAllSame(origin, size)) {
-      mNodes.at(index >> 3)->children[index & 0b111] = mPalette.at(pGrid.queryVoxelData(origin));
-      *pCompletedCount += std::log2(size) * size * size * size;
-      continue;
+  // A brick is two levels, bits 8i to 8i+7 of the mask are its ith 2x2x2 block
+  std::array<uint32_t, 8> blocks;
+  auto brickToHandle = [&](uint64_t pMask) {
+    for (uint i = 0; i < 8; ++i) {
+      const uint8_t block = pMask >> (i << 3);
+      std::array<uint32_t, 8> voxels;
+      for (uint j = 0; j < 8; ++j) voxels[j] = block >> j & 1 ? solid : air;
+      blocks[i] = collapse(voxels);
     }
+    return collapse(blocks);
+  };
 
-    size >>= 1;
-    for (uint j = 0; j < 8; ++j)
-      queue.push_back(std::make_tuple(mNodes.size() << 3 | j, origin + toChildPos(j) * size, size));
-    std::shared_ptr<Node> n = std::make_shared<Node>();
-    mNodes.emplace_back(n);
-    mNodes.at(index >> 3)->children[index & 0b111] = n;
-    *pCompletedCount += size * size * size << 3;
+  if (mResolution <= 4) {
+    uint32_t h = brickToHandle(bricks[0].mask);
+    if (mResolution == 4) mRoot = h;
+    else if (mResolution == 2) mRoot = blocks[0];
+    else mRoot = bricks[0].mask & 1 ? solid : air;
+    return;
   }
 
-// Node* generateImpl(const glm::uvec3& pOrigin, uint pSize) {
-//   if (pGrid.isRegionAllSame(pOrigin, pSize))
-//     return &mPalette.at(pGrid.queryVoxelData(pOrigin));
+  // Bricks are sorted so each level only has one node being filled at a time, it's finished once a brick
+  // with a different ancestor at that level comes in. Missing children are air.
+  struct Pending {
+    uint64_t prefix;
+    bool isActive = false;
+    std::array<uint32_t, 8> children;
+  };
+  const uint depth = std::countr_zero(mResolution);
+  std::vector<Pending> levels(depth);
+
+  auto put = [&](uint pLevel, uint64_t pCode, uint32_t pHandle) {
+    Pending& p = levels[pLevel];
+    if (!p.isActive) {
+      p.isActive = true;
+      p.prefix = pCode >> 3;
+      p.children.fill(air);
+    }
+    p.children[pCode & 7] = pHandle;
+  };
+  auto flush = [&](uint pLevel) {
+    Pending& p = levels[pLevel];
+    p.isActive = false;
+    uint32_t h = collapse(p.children);
+    if (pLevel + 1 == depth) mRoot = h;
+    else put(pLevel + 1, p.prefix, h);
+  };
 
-//   pSize >>= 1;
-//   Node* n = new Node;
-//   mNodes.emplace_back(n);
-//   for (uint i = 0; i < 8; ++i)
-//     n->children[i] = generateImpl(pOrigin + toChildPos(i) * pSize, pSize);
-//   return n;
-// }
+  for (const Brick& b : bricks) {
+    for (uint level = 2; level < depth; ++level)
+      if (levels[level].isActive && levels[level].prefix != b.code >> (3 * (level - 1))) flush(level);
+    put(2, b.code, brickToHandle(b.mask));
+  }
+  for (uint level = 2; level < depth; ++level)
+    if (levels[level].isActive) flush(level);
 }
 
 void Octree::attach(Octree& pOctree, glm::uvec3& pOrigin) {
+  TRACE_SCOPE("Octree::attach");
   if (pOctree.getResolution() > mResolution) throw std::runtime_error("Can't attach a larger octree");
+
+  // Append the subtrees nodes to the pool
+  const uint32_t offset = mNodes.size();
+  mNodes.reserve(mNodes.size() + pOctree.mNodes.size());
+  for (const std::array<uint32_t, 8>& node : pOctree.mNodes) {
+    std::array<uint32_t, 8>& n = mNodes.emplace_back(node);
+    for (uint32_t& child : n)
+      if (!isLeaf(child)) child += offset;
+  }
+  const uint32_t root = isLeaf(pOctree.mRoot) ? pOctree.mRoot : pOctree.mRoot + offset;
+
+  // Walk down to the slot the subtree replaces, splitting leaves on the way
+  uint32_t parent = NO_NODE;
+  uint8_t childIndex = 0;
+  auto slot = [&]() -> uint32_t& { return parent == NO_NODE ? mRoot : mNodes[parent][childIndex]; };
   glm::uvec3 o(0);
-  uint size = mResolution;
-  std::shared_ptr<Node>& n = mNodes.size() == 0 ? mNodes.emplace_back(std::make_shared<Node>()) : mNodes.at(0);
-  while ((size >>= 1) != (pOctree.getResolution() >> 1)) {
-    uint i = toChildIndex((pOrigin - o) / size);
-    o = toChildPos(i) * size;
-    if (!n->children[i]) n->children[i] = std::make_shared<Node>();
-    n = n->children[i];
+  for (uint size = mResolution >> 1; size >= pOctree.getResolution(); size >>= 1) {
+    if (isLeaf(slot())) {
+      const uint32_t leaf = slot();
+      mNodes.emplace_back().fill(leaf);
+      slot() = mNodes.size() - 1;
+    }
+    parent = slot();
+    childIndex = toChildIndex((pOrigin - o) / size);
+    o += toChildPos(childIndex) * size;
   }
-  n = pOctree.mNodes.at(0);
+  slot() = root;
 }
 
-std::vector<std::array<uint32_t, 8>> Octree::generateIndices() {
-  std::vector<std::array<uint32_t, 8>> indices;
-  std::vector<std::array<uint32_t*, 8>> arangement;
-  std::vector<std::shared_ptr<Node>> queue;
+Octree Octree::downsample() {
+  TRACE_SCOPE("Octree::downsample");
+  if (mResolution == 1) throw std::runtime_error("Can't downsample an octree with a resolution of 1");
+  Octree lod(mResolution >> 1, mPaletteSize);
 
-  processNode(mNodes.at(0), arangement, queue); // Process root node
-  
-  for (uint i = 0; i < queue.size(); ++i)
-    processNode(queue[i], arangement, queue);
+  // Solid voxels win over air so thin surfaces aren't eroded away, ties go to the lowest palette index
+  auto reduce = [](const std::array<uint32_t, 8>& pVoxels) {
+    uint32_t best = toLeaf(0);
+    uint bestCount = 0;
+    for (uint32_t v : pVoxels) {
+      if (v == toLeaf(0)) continue;
+      uint count = 0;
+      for (uint32_t w : pVoxels) count += w == v;
+      if (count > bestCount || (count == bestCount && v < best)) {
+        best = v;
+        bestCount = count;
+      }
+    }
+    return best;
+  };
+
+  // Uniform regions stay leaves, nodes spanning 2 voxels become leaves and everything above is rebuilt
+  auto build = [&](auto& pBuild, uint32_t pHandle, uint pSize) -> uint32_t {
+    if (isLeaf(pHandle)) return pHandle;
+    const std::array<uint32_t, 8>& node = mNodes[pHandle];
+    if (pSize == 2) return reduce(node);
+
+    std::array<uint32_t, 8> children;
+    for (uint i = 0; i < 8; ++i) children[i] = pBuild(pBuild, node[i], pSize >> 1);
+    bool isUniform = isLeaf(children[0]);
+    for (uint i = 1; i < 8 && isUniform; ++i) isUniform = children[i] == children[0];
+    if (isUniform) return children[0];
+    lod.mNodes.push_back(children);
+    return lod.mNodes.size() - 1;
+  };
+  lod.mRoot = build(build, mRoot, mResolution);
+
+  return lod;
+}
+
+std::vector<uint64_t> Octree::getPaletteHistogram() {
+  TRACE_SCOPE("Octree::getPaletteHistogram");
+  std::vector<uint64_t> histogram(mPaletteSize + 1, 0);
+  auto count = [&](auto& pCount, uint32_t pHandle, uint64_t pSize) -> void {
+    if (isLeaf(pHandle)) {
+      const uint32_t index = pHandle & ~LEAF_BIT;
+      if (index >= histogram.size()) histogram.resize(index + 1, 0);
+      histogram[index] += pSize * pSize * pSize;
+      return;
+    }
+    for (uint32_t child : mNodes[pHandle]) pCount(pCount, child, pSize >> 1);
+  };
+  count(count, mRoot, mResolution);
+  return histogram;
+}
 
-  indices.resize(arangement.size());
-  for (uint i = 0; i < arangement.size(); ++i)
+void Octree::remapPalette(const std::vector<uint32_t>& pMap, uint pPaletteSize) {
+  TRACE_SCOPE("Octree::remapPalette");
+  if (isLeaf(mRoot)) mRoot = toLeaf(pMap[mRoot & ~LEAF_BIT]);
+  for (std::array<uint32_t, 8>& node : mNodes)
+    for (uint32_t& child : node)
+      if (isLeaf(child)) child = toLeaf(pMap[child & ~LEAF_BIT]);
+  mPaletteSize = pPaletteSize;
+  collapse();
+}
+
+uint Octree::collapse() {
+  TRACE_SCOPE("Octree::collapse");
+  uint reachableCount = 0;
+  std::vector<std::array<uint32_t, 8>> nodes;
+  nodes.reserve(mNodes.size());
+
+  // Only nodes reachable from the root are kept, so subtrees replaced by attach are dropped too. They aren't counted as
+  // removed since collapsing didn't merge them.
+  auto build = [&](auto& pBuild, uint32_t pHandle) -> uint32_t {
+    if (isLeaf(pHandle)) return pHandle;
+    ++reachableCount;
+    std::array<uint32_t, 8> children;
+    for (uint i = 0; i < 8; ++i) children[i] = pBuild(pBuild, mNodes[pHandle][i]);
+    bool isUniform = isLeaf(children[0]);
+    for (uint i = 1; i < 8 && isUniform; ++i) isUniform = children[i] == children[0];
+    if (isUniform) return children[0];
+    nodes.push_back(children);
+    return nodes.size() - 1;
+  };
+  mRoot = build(build, mRoot);
+  mNodes = std::move(nodes);
+  return reachableCount - mNodes.size();
+}
+
+std::vector<uint32_t> Octree::getNodeOrder(Layout pLayout) {
+  TRACE_SCOPE("Octree::getNodeOrder");
+  std::vector<uint32_t> order;
+  if (isLeaf(mRoot)) return order;
+  order.reserve(mNodes.size());
+
+  auto pushChildren = [&](uint32_t pHandle) {
+    for (uint32_t child : mNodes[pHandle])
+      if (!isLeaf(child)) order.push_back(child);
+  };
+
+  if (pLayout == Layout::BreadthFirst) {
+    order.push_back(mRoot);
+    for (size_t i = 0; i < order.size(); ++i) pushChildren(order[i]);
+  }
+  else if (pLayout == Layout::DepthFirst) {
+    std::vector<uint32_t> stack = {mRoot};
+    while (!stack.empty()) {
+      const uint32_t h = stack.back();
+      stack.pop_back();
+      order.push_back(h);
+      for (uint i = 8; i-- > 0;)
+        if (!isLeaf(mNodes[h][i])) stack.push_back(mNodes[h][i]);
+    }
+  }
+  else {
+    // Children of a block's last level root the blocks that follow it
+    std::vector<uint32_t> stack = {mRoot};
+    while (!stack.empty()) {
+      size_t levelStart = order.size();
+      order.push_back(stack.back());
+      stack.pop_back();
+      for (uint depth = 1; depth < LAYOUT_BLOCK_DEPTH; ++depth) {
+        const size_t levelEnd = order.size();
+        for (size_t i = levelStart; i < levelEnd; ++i) pushChildren(order[i]);
+        levelStart = levelEnd;
+      }
+      for (size_t i = order.size(); i-- > levelStart;)
+        for (uint j = 8; j-- > 0;)
+          if (!isLeaf(mNodes[order[i]][j])) stack.push_back(mNodes[order[i]][j]);
+    }
+  }
+
+  return order;
+}
+
+std::vector<std::array<uint32_t, 8>> Octree::generateIndices(Layout pLayout) {
+  TRACE_SCOPE("Octree::generateIndices");
+  const uint32_t paletteStart = std::numeric_limits<uint32_t>::max() - mPaletteSize;
+
+  // A uniform octree still needs a root node
+  if (isLeaf(mRoot)) {
+    std::vector<std::array<uint32_t, 8>> indices(1);
+    indices[0].fill(paletteStart + (mRoot & ~LEAF_BIT));
+    return indices;
+  }
+
+  // Nodes are numbered by where they are in the layout
+  const std::vector<uint32_t> order = getNodeOrder(pLayout);
+  std::vector<uint32_t> numbers(mNodes.size());
+  for (uint32_t i = 0; i < order.size(); ++i) numbers[order[i]] = i;
+
+  std::vector<std::array<uint32_t, 8>> indices(order.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    const std::array<uint32_t, 8>& node = mNodes[order[i]];
     for (uint j = 0; j < 8; ++j)
-      indices[i][j] = *arangement[i][j];
+      indices[i][j] = isLeaf(node[j]) ? paletteStart + (node[j] & ~LEAF_BIT) : numbers[node[j]];
+  }
 
   return indices;
 }
 
+struct IndicesHash {
+  size_t operator()(const std::array<uint32_t, 8>& pNode) const {
+    uint64_t h = 0xcbf29ce484222325;
+    for (uint32_t i : pNode) {
+      h ^= i;
+      h *= 0x100000001b3;
+      h ^= h >> 29;
+    }
+    return h;
+  }
+};
+
+uint Octree::deduplicateIndices(std::vector<std::array<uint32_t, 8>>& pIndices) {
+  TRACE_SCOPE("Octree::deduplicateIndices");
+  const uint32_t nodeCount = pIndices.size();
+  std::vector<uint32_t> remap(nodeCount);
+  std::unordered_map<std::array<uint32_t, 8>, uint32_t, IndicesHash> unique;
+  unique.reserve(nodeCount);
+
+  // Children always come after their parent in every layout, so walking backwards sees every child before the
+  // nodes pointing to it. The first copy found (the one with the largest index) becomes the shared one,
+  // which keeps children after their parents. The root is never merged so it stays at index 0.
+  for (uint32_t i = nodeCount; i-- > 0;) {
+    std::array<uint32_t, 8>& node = pIndices[i];
+    for (uint32_t& child : node)
+      if (child < nodeCount) child = remap[child];
+    remap[i] = i == 0 ? 0 : unique.try_emplace(node, i).first->second;
+  }
+
+  // Compact the remaining nodes keeping their relative order
+  std::vector<uint32_t> compacted(nodeCount);
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < nodeCount; ++i)
+    if (remap[i] == i) compacted[i] = size++;
+  size = 0;
+  for (uint32_t i = 0; i < nodeCount; ++i) {
+    if (remap[i] != i) continue;
+    pIndices[size] = pIndices[i];
+    for (uint32_t& child : pIndices[size])
+      if (child < nodeCount) child = compacted[child];
+    ++size;
+  }
+  pIndices.resize(size);
+  return size;
+}
+
 void Octree::resizePalette(uint pSize) {
-  // mPalette.erase(mPalette.begin() + pSize + 1, mPalette.end());
-  mPalette.resize(pSize + 1);
-  for (uint i = 0; i <= pSize; ++i)
-    mPalette[i]->index = std::numeric_limits<uint32_t>::max() - pSize + i;
+  mPaletteSize = pSize;
+}
+
+uint Octree::getNodeCount() {
+  return mNodes.size();
 }
 
 uint Octree::getResolution() {
   return mResolution;
 }
 
-void Octree::write(std::string pPath) {
+uint32_t Octree::writeIndices(std::ofstream& pOut, uint32_t pPaletteStart, Layout pLayout) {
+  TRACE_SCOPE("Octree::writeIndices");
+  std::vector<std::array<uint32_t, 8>> buffer;
+  buffer.reserve(WRITE_BUFFER_NODES);
+
+  if (isLeaf(mRoot)) {
+    buffer.emplace_back().fill(pPaletteStart + (mRoot & ~LEAF_BIT));
+    pOut.write(reinterpret_cast<char*>(buffer.data()), sizeof(buffer[0]));
+    return 1;
+  }
+
+  // Other layouts need every node numbered before the first record can be written
+  if (pLayout != Layout::BreadthFirst) {
+    const std::vector<uint32_t> order = getNodeOrder(pLayout);
+    std::vector<uint32_t> numbers(mNodes.size());
+    for (uint32_t i = 0; i < order.size(); ++i) numbers[order[i]] = i;
+
+    for (uint32_t h : order) {
+      std::array<uint32_t, 8>& n = buffer.emplace_back();
+      for (uint j = 0; j < 8; ++j)
+        n[j] = isLeaf(mNodes[h][j]) ? pPaletteStart + (mNodes[h][j] & ~LEAF_BIT) : numbers[mNodes[h][j]];
+      if (buffer.size() == WRITE_BUFFER_NODES) {
+        pOut.write(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+        buffer.clear();
+      }
+    }
+    pOut.write(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+    return order.size();
+  }
+
+  // Same breadth first numbering as generateIndices but records are flushed as they fill the buffer
+  std::vector<uint32_t> queue = {mRoot};
+  for (uint i = 0; i < queue.size(); ++i) {
+    const std::array<uint32_t, 8>& node = mNodes[queue[i]];
+    std::array<uint32_t, 8>& n = buffer.emplace_back();
+    for (uint j = 0; j < 8; ++j) {
+      if (isLeaf(node[j])) n[j] = pPaletteStart + (node[j] & ~LEAF_BIT);
+      else {
+        n[j] = queue.size();
+        queue.push_back(node[j]);
+      }
+    }
+    if (buffer.size() == WRITE_BUFFER_NODES) {
+      pOut.write(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+      buffer.clear();
+    }
+  }
+  pOut.write(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+
+  return queue.size();
+}
+
+void Octree::write(std::string pPath, bool pIsDAG, Layout pLayout, bool pIsCompact) {
+  TRACE_SCOPE("Octree::write");
   // Write octree
   pPath.append(".vm8");
-  std::println("Generating indices");
   VMesh::Timer t;
-  std::vector<std::array<uint32_t, 8>> indices = generateIndices();
-  std::println("Generating indices took: {}", t.getTime());
+
+  // Deduplicating and compacting need the whole index table
+  std::vector<std::array<uint32_t, 8>> indices;
+  if (pIsDAG || pIsCompact) {
+    std::println("Generating indices");
+    indices = generateIndices(pLayout);
+    std::println("Generating indices took: {}", t.getTime());
+  }
+  if (pIsDAG) {
+    std::println("Deduplicating subtrees");
+    t.start();
+    uint nodeCount = indices.size();
+    deduplicateIndices(indices);
+    std::println("Deduplicating subtrees took: {}", t.getTime());
+    std::println("Nodes: {} -> {} ({:.1f}%)", nodeCount, indices.size(), 100.0 * indices.size() / nodeCount);
+  }
+  std::vector<uint8_t> compact;
+  if (pIsCompact) {
+    std::println("Compacting indices");
+    t.start();
+    compact = encodeCompactIndices(indices, mPaletteSize);
+    std::println("Compacting indices took: {}", t.getTime());
+    std::println("Bytes: {} -> {} ({:.1f}%)", indices.size() * sizeof(indices[0]), compact.size(), 100.0 * compact.size() / (indices.size() * sizeof(indices[0])));
+  }
 
   t.start();
   std::println("Writing octree to: \e[1;3;4;33m{}\e[0m", pPath);
@@ -124,31 +561,41 @@ void Octree::write(std::string pPath) {
 
   // Header
   fout << "VMESH8";
-  const uint32_t fileVersion = 100;
+  const uint32_t fileVersion = (pIsDAG ? 101 : 100) + (pIsCompact ? 2 : 0);
   fout.write(reinterpret_cast<const char*>(&fileVersion), sizeof(fileVersion));
   // Resolution
   fout.write(reinterpret_cast<char*>(&mResolution), sizeof(uint32_t));
   // Palette size
-  uint32_t paletteSize = mPalette.size()  - 1;
-  fout.write(reinterpret_cast<char*>(&paletteSize), sizeof(uint32_t));
-  // Indices
-  uint32_t indicesSize = indices.size();
+  fout.write(reinterpret_cast<char*>(&mPaletteSize), sizeof(uint32_t));
+  // Indices, the count is patched in once the indices are written
+  std::streampos indicesSizePos = fout.tellp();
+  uint32_t indicesSize = 0;
+  fout.write(reinterpret_cast<char*>(&indicesSize), sizeof(uint32_t));
+  if (pIsCompact) {
+    indicesSize = indices.size();
+    const uint64_t compactSize = compact.size();
+    fout.write(reinterpret_cast<const char*>(&compactSize), sizeof(uint64_t));
+    fout.write(reinterpret_cast<const char*>(compact.data()), compact.size());
+  }
+  else if (pIsDAG) {
+    indicesSize = indices.size();
+    fout.write(reinterpret_cast<char*>(indices.data()), indices.size() * 8ull * sizeof(uint32_t));
+  }
+  else indicesSize = writeIndices(fout, std::numeric_limits<uint32_t>::max() - mPaletteSize, pLayout);
+  fout.seekp(indicesSizePos);
   fout.write(reinterpret_cast<char*>(&indicesSize), sizeof(uint32_t));
-  fout.write(reinterpret_cast<char*>(indices.data()), indices.size() * 8ull * sizeof(uint32_t));
 
   fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write output file");
   std::println("Writing took: {}", t.getTime());
 }
 
-void Octree::processNode(std::shared_ptr<Node> pNode, std::vector<std::array<uint32_t*, 8>>& pArangement, std::vector<std::shared_ptr<Node>>& pQueue) {
-  pNode->index = pArangement.size();
-  pArangement.emplace_back();
-  for (uint i = 0; i < 8; ++i) {
-    std::shared_ptr<Node> n = pNode->children[i] ? pNode->children[i] : mPalette.at(0);
-    pArangement.back()[i] = &n->index;
-    if (n->index < std::numeric_limits<uint32_t>::max() - mPalette.size()) // Isnt leaf
-      pQueue.push_back(n);
-  }
+bool Octree::parseLayout(const std::string& pStr, Layout& pLayout) {
+  if (pStr == "breadth-first") pLayout = Layout::BreadthFirst;
+  else if (pStr == "depth-first") pLayout = Layout::DepthFirst;
+  else if (pStr == "blocked") pLayout = Layout::Blocked;
+  else return false;
+  return true;
 }
 
 uint Octree::toChildIndex(const glm::uvec3& pPos) {
@@ -160,6 +607,32 @@ uint Octree::toChildIndex(const glm::uvec3& pPos) {
   return (localChildPos.x << 0) | (localChildPos.y << 1) | (localChildPos.z << 2); // Index in childIndices 0 - 7
 }
 
+uint64_t Octree::toMorton(const glm::uvec3& pPos) {
+  auto expand = [](uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8)  & 0x100f00f00f00f00f;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3;
+    v = (v | v << 2)  & 0x1249249249249249;
+    return v;
+  };
+  return expand(pPos.x) | expand(pPos.y) << 1 | expand(pPos.z) << 2;
+}
+
+glm::uvec3 Octree::fromMorton(uint64_t pCode) {
+  auto compact = [](uint64_t v) {
+    v &= 0x1249249249249249;
+    v = (v ^ (v >> 2))  & 0x10c30c30c30c30c3;
+    v = (v ^ (v >> 4))  & 0x100f00f00f00f00f;
+    v = (v ^ (v >> 8))  & 0x1f0000ff0000ff;
+    v = (v ^ (v >> 16)) & 0x1f00000000ffff;
+    v = (v ^ (v >> 32)) & 0x1fffff;
+    return uint(v);
+  };
+  return glm::uvec3(compact(pCode), compact(pCode >> 1), compact(pCode >> 2));
+}
+
 glm::uvec3 Octree::toChildPos(uint8_t pChildIndex) {
   glm::uvec3 pos;
   pos.x = 1 & pChildIndex;
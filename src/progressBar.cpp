@@ -1,48 +1,104 @@
 #include "progressBar.hpp"
 
-void printProgressBar(const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, float pTotalInv, std::mutex* pSTDOUTMutex, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth) {
-  std::lock_guard<std::mutex> lock(*pSTDOUTMutex);
+static std::atomic<bool> isProgressBarsEnabled = true;
 
-  float progress = *pCompletedCount * pTotalInv;
-  std::print("\r\e[2K{}: ", pTitle);
-  float threshold = std::ceil(progress * pWidth);
+ProgressBar::ProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, std::function<uint64_t()> pRead, uint64_t pTotal, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth)
+:mState(std::make_unique<State>()) {
+  mState->stdoutMutex = pSTDOUTMutex;
+  mState->title = pTitle;
+  mState->read = std::move(pRead);
+  mState->total = pTotal;
+  mState->primaryEscapeColour = pPrimaryEscapeColour;
+  mState->secondaryEscapeColour = pSecondaryEscapeColour;
+  mState->width = pWidth;
+  mThread = std::thread(run, std::ref(*mState));
+}
+
+ProgressBar& ProgressBar::operator=(ProgressBar&& pOther) {
+  wait();
+  mState = std::move(pOther.mState);
+  mThread = std::move(pOther.mThread);
+  return *this;
+}
+
+ProgressBar::~ProgressBar() {
+  wait();
+}
+
+bool ProgressBar::valid() const {
+  return mState != nullptr;
+}
+
+void ProgressBar::wait() {
+  if (!mState) return;
+  {
+    std::lock_guard<std::mutex> lock(mState->mutex);
+    mState->isDone = true;
+  }
+  mState->cv.notify_one();
+  mThread.join();
+  mState.reset();
+}
 
-  std::print("\e[{}m", pPrimaryEscapeColour);
+void ProgressBar::print(State& pState) {
+  std::lock_guard<std::mutex> lock(*pState.stdoutMutex);
+
+  const uint64_t completedCount = std::min(pState.read(), pState.total);
+  float progress = pState.total ? completedCount / float(pState.total) : 1.f;
+  std::print("\r\e[2K{}: ", pState.title);
+  float threshold = std::ceil(progress * pState.width);
+
+  std::print("\e[{}m", pState.primaryEscapeColour);
 
   for (uint i = 0; i < threshold; ++i) std::print("━");
 
-  if (threshold <= pWidth - 1) {
-    std::print("╸\e[{}m", pSecondaryEscapeColour);
+  if (threshold <= pState.width - 1) {
+    std::print("╸\e[{}m", pState.secondaryEscapeColour);
 
-    for (uint i = 0; i < pWidth - threshold - 1; ++i) std::print("━");
+    for (uint i = 0; i < pState.width - threshold - 1; ++i) std::print("━");
 
     std::print("\e[49m");
   }
-  else std::print("\e[49;{}m", pPrimaryEscapeColour);
+  else std::print("\e[49;{}m", pState.primaryEscapeColour);
 
-  std::print("\e[39m {}% [ {} / {} ]", std::ceil(progress * 100.f), *pCompletedCount, pTotal); // Reset
+  std::print("\e[39m {}% [ {} / {} ]", std::ceil(progress * 100.f), completedCount, pState.total); // Reset
 
   std::cout << std::flush;
 }
 
-static bool checkIfDoneForTime(uint64_t* pCompletedCount, uint64_t pTotal, std::chrono::duration<double, std::milli> pDuration) {
-  std::chrono::time_point<std::chrono::system_clock> startTime = std::chrono::system_clock::now();
-  while (std::chrono::duration<double, std::milli>(std::chrono::system_clock::now() - startTime).count() < pDuration.count())
-    if (*pCompletedCount == pTotal) return true;
-  return false;
+void ProgressBar::run(State& pState) {
+  print(pState);
+  std::unique_lock<std::mutex> lock(pState.mutex);
+  while (!pState.cv.wait_for(lock, std::chrono::milliseconds(100), [&]() { return pState.isDone; })) {
+    lock.unlock();
+    print(pState);
+    lock.lock();
+  }
+  lock.unlock();
+  print(pState);
+  std::lock_guard<std::mutex> stdoutLock(*pState.stdoutMutex);
+  std::println("");
 }
 
-void printProgressBarUntilDone(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth) {
-  float totalInv = 1.f/pTotal;
-  printProgressBar(pTitle, pCompletedCount, pTotal, totalInv, pSTDOUTMutex, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
-  while (!checkIfDoneForTime(pCompletedCount, pTotal, std::chrono::milliseconds(100)))
-    printProgressBar(pTitle, pCompletedCount, pTotal, totalInv, pSTDOUTMutex, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
-  printProgressBar(pTitle, pCompletedCount, pTotal, totalInv, pSTDOUTMutex, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
-  std::lock_guard<std::mutex> lock(*pSTDOUTMutex);
-  std::println("");
+void setProgressBarsEnabled(bool pIsEnabled) {
+  isProgressBarsEnabled = pIsEnabled;
 }
 
-std::future<void> startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth) {
-  return std::async(std::launch::async, printProgressBarUntilDone, pSTDOUTMutex, pTitle, pCompletedCount, pTotal, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
+bool areProgressBarsEnabled() {
+  return isProgressBarsEnabled;
 }
 
+ProgressBar startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, const std::atomic<uint64_t>* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth) {
+  if (!isProgressBarsEnabled) return ProgressBar();
+  return ProgressBar(pSTDOUTMutex, pTitle, [pCompletedCount]() { return pCompletedCount->load(std::memory_order_relaxed); }, pTotal, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
+}
+
+ProgressBar startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth) {
+  if (!isProgressBarsEnabled) return ProgressBar();
+  return ProgressBar(pSTDOUTMutex, pTitle, [pCompletedCount]() -> uint64_t { return std::atomic_ref<uint>(*pCompletedCount).load(std::memory_order_relaxed); }, pTotal, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
+}
+
+ProgressBar startProgressBar(std::mutex* pSTDOUTMutex, const std::string& pTitle, uint64_t* pCompletedCount, uint64_t pTotal, uint8_t pPrimaryEscapeColour, uint8_t pSecondaryEscapeColour, uint pWidth) {
+  if (!isProgressBarsEnabled) return ProgressBar();
+  return ProgressBar(pSTDOUTMutex, pTitle, [pCompletedCount]() { return std::atomic_ref<uint64_t>(*pCompletedCount).load(std::memory_order_relaxed); }, pTotal, pPrimaryEscapeColour, pSecondaryEscapeColour, pWidth);
+}
@@ -0,0 +1,142 @@
+#include "sparseVoxels.hpp"
+#include "octree.hpp"
+#include "trace.hpp"
+
+SparseVoxels::SparseVoxels(uint pResolution, const glm::uvec3& pOrigin)
+:mResolution(pResolution), mOrigin(pOrigin) {}
+
+void SparseVoxels::voxelizeTriangle(const glm::vec3& pA, const glm::vec3& pB, const glm::vec3& pC) {
+  // Voxels of this region the triangles bounding box covers
+  const glm::vec3 regionMin(mOrigin), regionMax(mOrigin + glm::uvec3(mResolution - 1));
+  const glm::vec3 lo = glm::max(glm::floor(glm::min(pA, glm::min(pB, pC))), regionMin);
+  const glm::vec3 hi = glm::min(glm::floor(glm::max(pA, glm::max(pB, pC))), regionMax);
+  if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z) return;
+
+  const glm::vec3 n = glm::cross(pB - pA, pC - pA);
+  const glm::vec3 absN = glm::abs(n);
+  if (absN.x + absN.y + absN.z == 0) return; // No area
+
+  // Walk columns along the axis the triangle faces most, its plane only crosses a couple of voxels in each column
+  const uint d = absN.x >= absN.y && absN.x >= absN.z ? 0 : absN.y >= absN.z ? 1 : 2;
+  const uint u = (d + 1) % 3, v = (d + 2) % 3;
+  const float k = glm::dot(n, pA);
+  const glm::uvec3 from(lo), to(hi);
+
+  glm::uvec3 pos;
+  for (pos[u] = from[u]; pos[u] <= to[u]; ++pos[u]) for (pos[v] = from[v]; pos[v] <= to[v]; ++pos[v]) {
+    float dMin = std::numeric_limits<float>::infinity(), dMax = -std::numeric_limits<float>::infinity();
+    for (uint corner = 0; corner < 4; ++corner) {
+      float pd = (k - n[u] * (pos[u] + (corner & 1)) - n[v] * (pos[v] + (corner >> 1))) / n[d];
+      dMin = std::min(dMin, pd);
+      dMax = std::max(dMax, pd);
+    }
+    dMin = std::max(std::floor(dMin), lo[d]);
+    dMax = std::min(std::floor(dMax), hi[d]);
+    for (float pd = dMin; pd <= dMax; ++pd) {
+      pos[d] = pd;
+      if (triangleBoxOverlap(glm::vec3(pos) + glm::vec3(0.5f), 0.5f, pA, pB, pC)) addVoxel(pos - mOrigin);
+    }
+  }
+}
+
+bool SparseVoxels::voxelizeMeshes(std::span<const MeshView> pMeshes, std::atomic<uint64_t>* pTrisComplete) {
+  TRACE_SCOPE("SparseVoxels::voxelizeMeshes");
+  uint64_t pending = 0;
+  for (const MeshView& m : pMeshes) {
+    for (uint64_t j = 0; j + 2 < m.indexCount; j += 3) {
+      voxelizeTriangle(m.getPosition(m.indices[j]), m.getPosition(m.indices[j + 1]), m.getPosition(m.indices[j + 2]));
+      if (++pending == PROGRESS_BATCH && pTrisComplete) pTrisComplete->fetch_add(std::exchange(pending, 0), std::memory_order_relaxed);
+      if (mMaxBytes && getBytes() > mMaxBytes) return false;
+    }
+  }
+  if (pTrisComplete) pTrisComplete->fetch_add(pending, std::memory_order_relaxed);
+  return true;
+}
+
+bool SparseVoxels::voxelizeTriangles(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, std::atomic<uint64_t>* pTrisComplete) {
+  TRACE_SCOPE("SparseVoxels::voxelizeTriangles");
+  uint64_t pending = 0;
+  for (const TriangleRef& t : pTriangles) {
+    const MeshView& m = pMeshes[t.mesh];
+    voxelizeTriangle(m.getPosition(m.indices[t.index]), m.getPosition(m.indices[t.index + 1]), m.getPosition(m.indices[t.index + 2]));
+    if (++pending == PROGRESS_BATCH && pTrisComplete) pTrisComplete->fetch_add(std::exchange(pending, 0), std::memory_order_relaxed);
+    if (mMaxBytes && getBytes() > mMaxBytes) return false;
+  }
+  if (pTrisComplete) pTrisComplete->fetch_add(pending, std::memory_order_relaxed);
+  return true;
+}
+
+void SparseVoxels::setMaxBytes(uint64_t pMaxBytes) {
+  mMaxBytes = pMaxBytes;
+}
+
+uint64_t SparseVoxels::getBytes() const {
+  return mBricks.capacity() * sizeof(Brick);
+}
+
+void SparseVoxels::compact() {
+  if (mCompactedSize == mBricks.size()) return;
+  auto less = [](const Brick& pA, const Brick& pB) { return pA.code < pB.code; };
+  std::sort(mBricks.begin() + mCompactedSize, mBricks.end(), less);
+  std::inplace_merge(mBricks.begin(), mBricks.begin() + mCompactedSize, mBricks.end(), less);
+  size_t size = 0;
+  for (size_t i = 0; i < mBricks.size(); ++i) {
+    if (size && mBricks[size - 1].code == mBricks[i].code) mBricks[size - 1].mask |= mBricks[i].mask;
+    else mBricks[size++] = mBricks[i];
+  }
+  mBricks.resize(size);
+  mCompactedSize = size;
+}
+
+const std::vector<Brick>& SparseVoxels::getBricks() {
+  compact();
+  return mBricks;
+}
+
+uint SparseVoxels::getResolution() const {
+  return mResolution;
+}
+
+uint64_t SparseVoxels::getVoxelCount() {
+  compact();
+  uint64_t count = 0;
+  for (const Brick& b : mBricks) count += std::popcount(b.mask);
+  return count;
+}
+
+void SparseVoxels::addVoxel(const glm::uvec3& pPos) {
+  const uint64_t code = Octree::toMorton(pPos);
+  // Voxels of a triangle are mostly next to each other so merge into the last brick when possible
+  if (!mBricks.empty() && mBricks.back().code == code >> 6) mBricks.back().mask |= 1ull << (code & 63);
+  else {
+    mBricks.push_back({code >> 6, 1ull << (code & 63)});
+    if (mBricks.size() - mCompactedSize > std::max<size_t>(mCompactedSize, 1 << 20)) compact();
+  }
+}
+
+// Separating axis test between a triangle and a cube, Akenine-Moller
+bool SparseVoxels::triangleBoxOverlap(const glm::vec3& pCenter, float pHalfSize, const glm::vec3& pA, const glm::vec3& pB, const glm::vec3& pC) {
+  const glm::vec3 v0 = pA - pCenter, v1 = pB - pCenter, v2 = pC - pCenter;
+
+  auto isSeparated = [&](const glm::vec3& pAxis) {
+    const float p0 = glm::dot(v0, pAxis), p1 = glm::dot(v1, pAxis), p2 = glm::dot(v2, pAxis);
+    const float r = pHalfSize * (std::abs(pAxis.x) + std::abs(pAxis.y) + std::abs(pAxis.z));
+    return std::min(p0, std::min(p1, p2)) > r || std::max(p0, std::max(p1, p2)) < -r;
+  };
+
+  // Box face normals
+  for (uint i = 0; i < 3; ++i)
+    if (std::min(v0[i], std::min(v1[i], v2[i])) > pHalfSize || std::max(v0[i], std::max(v1[i], v2[i])) < -pHalfSize) return false;
+
+  // Triangle normal
+  const std::array<glm::vec3, 3> edges = {v1 - v0, v2 - v1, v0 - v2};
+  if (isSeparated(glm::cross(edges[0], edges[1]))) return false;
+
+  // Edge cross products
+  const std::array<glm::vec3, 3> axes = {glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1)};
+  for (const glm::vec3& e : edges)
+    for (const glm::vec3& a : axes)
+      if (isSeparated(glm::cross(e, a))) return false;
+
+  return true;
+}
@@ -0,0 +1,114 @@
+#include "stats.hpp"
+#include "trace.hpp"
+
+#include <ctime>
+#include <sys/resource.h>
+
+Stats::Scope::Scope(Stats& pStats, const char* pName)
+:mStats(&pStats), mName(pName), mStart(std::chrono::steady_clock::now()), mCpuStart(getProcessCpuTime()) {}
+
+Stats::Scope::~Scope() {
+  end();
+}
+
+void Stats::Scope::end() {
+  if (!mStats) return;
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  mStats->addPhase({mName, std::chrono::duration<double>(now - mStart).count(), getProcessCpuTime() - mCpuStart});
+#ifdef _PROFILING
+  if (isTraceEnabled.load(std::memory_order_relaxed)) addTraceEvent({mName, -1, mStart, now});
+#endif
+  mStats = nullptr;
+}
+
+Stats::Stats()
+:mStart(std::chrono::steady_clock::now()), mCpuStart(getProcessCpuTime()) {}
+
+void Stats::addPhase(const Phase& pPhase) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mPhases.push_back(pPhase);
+}
+
+void Stats::addSubdivision(const Subdivision& pSubdivision) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mSubdivisions.push_back(pSubdivision);
+}
+
+static std::string escapeJSON(const std::string& pStr) {
+  std::string escaped;
+  for (char c : pStr) {
+    if (c == '"' || c == '\\') escaped += '\\';
+    if (uint8_t(c) < 0x20) escaped += std::format("\\u{:04x}", uint8_t(c));
+    else escaped += c;
+  }
+  return escaped;
+}
+
+void Stats::write(const std::string& pPath) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+  const double cpuSeconds = getProcessCpuTime() - mCpuStart;
+  auto perSecond = [&](uint64_t pCount) { return wallSeconds > 0 ? pCount / wallSeconds : 0.0; };
+
+  std::sort(mSubdivisions.begin(), mSubdivisions.end(), [](const Subdivision& pA, const Subdivision& pB) { return pA.index < pB.index; });
+
+  std::ofstream fout;
+  fout.open(pPath, std::ios::out);
+  if (!fout.is_open()) throw std::runtime_error("Could not open stats file");
+
+  fout << "{\n";
+  fout << std::format("  \"input\": \"{}\",\n", escapeJSON(mInput));
+  fout << std::format("  \"format\": \"{}\",\n", mOutputFormat);
+  fout << std::format("  \"resolution\": {},\n  \"subdivisionLevel\": {},\n  \"jobs\": {},\n", mResolution, mSubdivisionLevel, mJobs);
+  fout << std::format("  \"wallSeconds\": {},\n  \"cpuSeconds\": {},\n  \"peakRSSBytes\": {},\n", wallSeconds, cpuSeconds, getPeakRSS());
+  fout << std::format("  \"triangles\": {},\n  \"voxels\": {},\n  \"nodes\": {},\n  \"collapsedNodes\": {},\n  \"cachedSubdivisions\": {},\n  \"splits\": {},\n  \"paletteSize\": {},\n  \"bytesWritten\": {},\n", mTriangles, mVoxels, mNodes, mCollapsedNodes, mCachedSubdivisions, mSplits, mPaletteSize, mBytesWritten);
+  fout << std::format("  \"trianglesPerSecond\": {},\n  \"voxelsPerSecond\": {},\n", perSecond(mTriangles), perSecond(mVoxels));
+
+  fout << "  \"phases\": [";
+  for (size_t i = 0; i < mPhases.size(); ++i)
+    fout << std::format("{}\n    {{\"name\": \"{}\", \"wallSeconds\": {}, \"cpuSeconds\": {}}}", i ? "," : "", mPhases[i].name, mPhases[i].wallSeconds, mPhases[i].cpuSeconds);
+  fout << (mPhases.empty() ? "],\n" : "\n  ],\n");
+
+  fout << "  \"subdivisions\": [";
+  for (size_t i = 0; i < mSubdivisions.size(); ++i) {
+    const Subdivision& s = mSubdivisions[i];
+    fout << std::format("{}\n    {{\"index\": {}, \"voxelizationWallSeconds\": {}, \"voxelizationCpuSeconds\": {}, \"generationWallSeconds\": {}, \"generationCpuSeconds\": {}, \"triangles\": {}, \"voxels\": {}, \"nodes\": {}, \"cached\": {}}}",
+      i ? "," : "", s.index, s.voxelizationWallSeconds, s.voxelizationCpuSeconds, s.generationWallSeconds, s.generationCpuSeconds, s.triangles, s.voxels, s.nodes, s.isCached);
+  }
+  fout << (mSubdivisions.empty() ? "]\n" : "\n  ]\n");
+  fout << "}\n";
+
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write stats file");
+}
+
+static double toSeconds(const timespec& pTime) {
+  return pTime.tv_sec + pTime.tv_nsec * 1e-9;
+}
+
+double Stats::getProcessCpuTime() {
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return toSeconds(time);
+}
+
+double Stats::getThreadCpuTime() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return toSeconds(time);
+}
+
+uint64_t Stats::getPeakRSS() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return uint64_t(usage.ru_maxrss) * 1024; // Kilobytes on linux
+}
+
+uint64_t Stats::getFileSize(std::initializer_list<std::filesystem::path> pPaths) {
+  for (const std::filesystem::path& path : pPaths) {
+    std::error_code err;
+    const uint64_t size = std::filesystem::file_size(path, err);
+    if (!err) return size;
+  }
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "subtreeCache.hpp"
+#include "trace.hpp"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <bit>
+#include <format>
+#include <thread>
+
+// Words are mixed in one at a time, a multiply and shift is enough to spread float bits for a cache key
+static uint64_t mix(uint64_t pHash, uint64_t pValue) {
+  pHash = (pHash ^ pValue) * 0x9e3779b97f4a7c15;
+  return pHash ^ (pHash >> 29);
+}
+
+static uint64_t mixTriangle(uint64_t pHash, const MeshView& pMesh, uint64_t pIndex) {
+  for (uint i = 0; i < 3; ++i) {
+    const glm::vec3& v = pMesh.getPosition(pMesh.indices[pIndex + i]);
+    pHash = mix(pHash, uint64_t(std::bit_cast<uint32_t>(v.x)) << 32 | std::bit_cast<uint32_t>(v.y));
+    pHash = mix(pHash, std::bit_cast<uint32_t>(v.z));
+  }
+  return pHash;
+}
+
+SubtreeCache::SubtreeCache(const std::filesystem::path& pDirectory)
+:mDirectory(pDirectory) {
+  std::filesystem::create_directories(mDirectory);
+}
+
+uint64_t SubtreeCache::hashTriangles(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, uint64_t pSeed) {
+  TRACE_SCOPE("SubtreeCache::hashTriangles");
+  uint64_t hash = mix(pSeed, pTriangles.size());
+  for (const TriangleRef& t : pTriangles) hash = mixTriangle(hash, pMeshes[t.mesh], t.index);
+  return hash;
+}
+
+uint64_t SubtreeCache::hashTriangles(std::span<const MeshView> pMeshes, uint64_t pSeed) {
+  TRACE_SCOPE("SubtreeCache::hashTriangles");
+  uint64_t hash = pSeed;
+  for (const MeshView& m : pMeshes) {
+    hash = mix(hash, m.indexCount / 3);
+    for (uint64_t j = 0; j + 2 < m.indexCount; j += 3) hash = mixTriangle(hash, m, j);
+  }
+  return hash;
+}
+
+uint64_t SubtreeCache::hashValues(std::initializer_list<uint64_t> pValues, uint64_t pSeed) {
+  uint64_t hash = mix(pSeed, VERSION);
+  for (uint64_t v : pValues) hash = mix(hash, v);
+  return hash;
+}
+
+bool SubtreeCache::load(uint64_t pKey, Octree& pOctree, uint64_t& pVoxelCount) {
+  TRACE_SCOPE("SubtreeCache::load");
+  std::ifstream fin;
+  fin.open(getPath(pKey), std::ios::in | std::ios::binary);
+  if (!fin.is_open()) return false;
+
+  Header header;
+  fin.read(reinterpret_cast<char*>(&header), sizeof(Header));
+  if (!fin || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION || header.resolution != pOctree.mResolution) return false;
+
+  // Truncated or stale entries are misses rather than trusted, the node count has to match the file and every child
+  // has to be a leaf in the palette or a node in it
+  std::error_code err;
+  const uint64_t fileSize = std::filesystem::file_size(getPath(pKey), err);
+  if (err || header.nodeCount > (fileSize - sizeof(Header)) / sizeof(std::array<uint32_t, 8>) || sizeof(Header) + header.nodeCount * sizeof(std::array<uint32_t, 8>) != fileSize) return false;
+
+  std::vector<std::array<uint32_t, 8>> nodes(header.nodeCount);
+  fin.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(nodes[0]));
+  if (!fin) return false;
+  // Leaves can be air or one of pOctree's colours
+  auto isValid = [&](uint32_t pHandle) { return Octree::isLeaf(pHandle) ? (pHandle & ~Octree::LEAF_BIT) <= pOctree.mPaletteSize : pHandle < nodes.size(); };
+  if (!isValid(header.root)) return false;
+  for (const std::array<uint32_t, 8>& node : nodes)
+    for (uint32_t child : node)
+      if (!isValid(child)) return false;
+
+  // A node reached twice would be a cycle that attach would never get out of
+  std::vector<bool> isReached(nodes.size(), false);
+  std::vector<uint32_t> stack;
+  if (!Octree::isLeaf(header.root)) stack.push_back(header.root);
+  while (!stack.empty()) {
+    const uint32_t node = stack.back();
+    stack.pop_back();
+    if (isReached[node]) return false;
+    isReached[node] = true;
+    for (uint32_t child : nodes[node])
+      if (!Octree::isLeaf(child)) stack.push_back(child);
+  }
+
+  pOctree.mRoot = header.root;
+  pOctree.mNodes = std::move(nodes);
+  pVoxelCount = header.voxelCount;
+  return true;
+}
+
+void SubtreeCache::store(uint64_t pKey, const Octree& pOctree, uint64_t pVoxelCount) {
+  TRACE_SCOPE("SubtreeCache::store");
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.resolution = pOctree.mResolution;
+  header.root = pOctree.mRoot;
+  header.voxelCount = pVoxelCount;
+  header.nodeCount = pOctree.mNodes.size();
+
+  // Written under a temporary name then renamed so an interrupted run never leaves half a subtree behind, batch jobs
+  // share the pid so the thread is part of the name too
+  const std::filesystem::path path = getPath(pKey);
+  std::filesystem::path tempPath = path;
+  tempPath += std::format(".{}-{:x}.tmp", getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::ofstream fout;
+  fout.open(tempPath, std::ios::out | std::ios::binary);
+  if (!fout.is_open()) throw std::runtime_error("Could not open subtree cache file");
+  fout.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  fout.write(reinterpret_cast<const char*>(pOctree.mNodes.data()), pOctree.mNodes.size() * sizeof(pOctree.mNodes[0]));
+  fout.close();
+  if (fout.fail()) {
+    std::filesystem::remove(tempPath);
+    throw std::runtime_error("Could not write subtree cache file");
+  }
+  std::filesystem::rename(tempPath, path);
+}
+
+std::filesystem::path SubtreeCache::getPath(uint64_t pKey) const {
+  return mDirectory / std::format("{:016x}.subtree", pKey);
+}
@@ -0,0 +1,250 @@
+#include "subtreeSpill.hpp"
+#include "trace.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+SubtreeSpill::SubtreeSpill(const std::filesystem::path& pDirectory, uint pResolution, uint pSubdivisionSize)
+:mDirectory(pDirectory), mInstance(mNextInstance++), mResolution(pResolution), mSubdivisionSize(pSubdivisionSize), mSubdimensions(pResolution / pSubdivisionSize) {
+  std::filesystem::create_directories(mDirectory);
+  const uint numSubdivisions = mSubdimensions * mSubdimensions * mSubdimensions;
+  mRoots.assign(numSubdivisions, Octree::toLeaf(0));
+  mNodeCounts.assign(numSubdivisions, 0);
+  mLevelCounts.resize(numSubdivisions);
+  mPaletteMaps.resize(numSubdivisions);
+}
+
+SubtreeSpill::~SubtreeSpill() {
+  for (uint i = 0; i < mRoots.size(); ++i) {
+    if (mRoots[i] != SUBTREE_BIT) continue;
+    std::error_code err;
+    std::filesystem::remove(getSpillPath(i), err);
+  }
+}
+
+void SubtreeSpill::add(uint pSubdivision, Octree& pOctree) {
+  TRACE_SCOPE("SubtreeSpill::add");
+  if (Octree::isLeaf(pOctree.mRoot)) {
+    mRoots[pSubdivision] = pOctree.mRoot;
+    return;
+  }
+
+  // Leaves keep LEAF_BIT so the palette size can still change before the merge
+  std::ofstream fout;
+  fout.open(getSpillPath(pSubdivision), std::ios::out | std::ios::binary);
+  if (!fout.is_open()) throw std::runtime_error("Could not open spill file");
+  mNodeCounts[pSubdivision] = pOctree.writeIndices(fout, Octree::LEAF_BIT);
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write spill file");
+  mRoots[pSubdivision] = SUBTREE_BIT;
+
+  // writeIndices numbers breadth first, so each level is a contiguous run of the file
+  std::vector<uint32_t>& levelCounts = mLevelCounts[pSubdivision];
+  std::vector<uint32_t> level = {pOctree.mRoot}, next;
+  while (!level.empty()) {
+    levelCounts.push_back(level.size());
+    next.clear();
+    for (uint32_t h : level)
+      for (uint32_t c : pOctree.mNodes[h])
+        if (!Octree::isLeaf(c)) next.push_back(c);
+    level.swap(next);
+  }
+}
+
+void SubtreeSpill::remapPalette(uint pSubdivision, const std::vector<uint32_t>& pMap, uint pPaletteSize) {
+  TRACE_SCOPE("SubtreeSpill::remapPalette");
+  uint32_t& root = mRoots[pSubdivision];
+  if (root != SUBTREE_BIT) {
+    root = Octree::toLeaf(pMap[root & ~Octree::LEAF_BIT]);
+    return;
+  }
+
+  std::vector<uint32_t> sorted = pMap;
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end()) {
+    mPaletteMaps[pSubdivision] = pMap;
+    return;
+  }
+
+  // Spill files are numbered like Octree nodes already, with the root first
+  Octree octree(mSubdivisionSize, pPaletteSize);
+  octree.mNodes.resize(mNodeCounts[pSubdivision]);
+  std::ifstream fin;
+  fin.open(getSpillPath(pSubdivision), std::ios::in | std::ios::binary);
+  if (!fin.is_open()) throw std::runtime_error("Could not open spill file");
+  fin.read(reinterpret_cast<char*>(octree.mNodes.data()), octree.mNodes.size() * sizeof(octree.mNodes[0]));
+  if (!fin) throw std::runtime_error("Spill file is truncated");
+  fin.close();
+  octree.mRoot = 0;
+  octree.remapPalette(pMap, pPaletteSize);
+
+  std::filesystem::remove(getSpillPath(pSubdivision));
+  root = Octree::toLeaf(0);
+  mNodeCounts[pSubdivision] = 0;
+  mLevelCounts[pSubdivision].clear();
+  add(pSubdivision, octree);
+}
+
+uint SubtreeSpill::write(std::string pPath, uint pPaletteSize) {
+  TRACE_SCOPE("SubtreeSpill::write");
+  pPath.append(".vm8");
+  VMesh::Timer t;
+  const uint32_t paletteStart = std::numeric_limits<uint32_t>::max() - pPaletteSize;
+
+  // Build the top levels, children are indices into top, leaves or SUBTREE_BIT | subdivision
+  auto isSubtree = [](uint32_t pHandle) { return !Octree::isLeaf(pHandle) && pHandle & SUBTREE_BIT; };
+  std::vector<std::array<uint32_t, 8>> top;
+  uint32_t root = Octree::toLeaf(0);
+  for (uint subdivision = 0; subdivision < mRoots.size(); ++subdivision) {
+    uint32_t h = mRoots[subdivision];
+    if (h == Octree::toLeaf(0)) continue;
+    if (h == SUBTREE_BIT) h |= subdivision;
+
+    const glm::uvec3 origin = glm::uvec3(subdivision / (mSubdimensions * mSubdimensions), (subdivision / mSubdimensions) % mSubdimensions, subdivision % mSubdimensions) * mSubdivisionSize;
+    uint32_t parent = Octree::NO_NODE;
+    uint8_t childIndex = 0;
+    auto slot = [&]() -> uint32_t& { return parent == Octree::NO_NODE ? root : top[parent][childIndex]; };
+    glm::uvec3 o(0);
+    for (uint size = mResolution >> 1; size >= mSubdivisionSize; size >>= 1) {
+      if (Octree::isLeaf(slot())) {
+        const uint32_t leaf = slot();
+        top.emplace_back().fill(leaf);
+        slot() = top.size() - 1;
+      }
+      parent = slot();
+      childIndex = Octree::toChildIndex((origin - o) / size);
+      o += Octree::toChildPos(childIndex) * size;
+    }
+    slot() = h;
+  }
+
+  // Merge top nodes whose children are all the same leaf, like Octree::collapse does after attaching. Spilled subtrees
+  // are already collapsed within themselves so only the top levels can merge.
+  uint collapsedCount = 0;
+  auto collapse = [&](auto& pCollapse, uint32_t pHandle) -> uint32_t {
+    if (Octree::isLeaf(pHandle) || isSubtree(pHandle)) return pHandle;
+    std::array<uint32_t, 8>& node = top[pHandle];
+    for (uint32_t& c : node) c = pCollapse(pCollapse, c);
+    bool isUniform = Octree::isLeaf(node[0]);
+    for (uint i = 1; i < 8 && isUniform; ++i) isUniform = node[i] == node[0];
+    if (!isUniform) return pHandle;
+    ++collapsedCount;
+    return node[0];
+  };
+  root = collapse(collapse, root);
+  if (collapsedCount) std::println("Collapsing uniform subtrees removed {} nodes", collapsedCount);
+
+  // Number the top nodes breadth first, the subtrees all sit one level below the deepest of them
+  std::vector<uint32_t> order, subtreeOrder;
+  std::vector<uint32_t> topIndices(top.size());
+  if (isSubtree(root)) subtreeOrder.push_back(root & ~SUBTREE_BIT);
+  else if (!Octree::isLeaf(root)) {
+    order.push_back(root);
+    for (uint i = 0; i < order.size(); ++i) {
+      for (uint32_t c : top[order[i]]) {
+        if (isSubtree(c)) subtreeOrder.push_back(c & ~SUBTREE_BIT);
+        else if (!Octree::isLeaf(c)) {
+          topIndices[c] = order.size();
+          order.push_back(c);
+        }
+      }
+    }
+  }
+
+  // Then each subtree level in turn, every subtree's nodes of that level in the order they're reached. This is the same
+  // breadth first numbering Octree::write gives the attached tree, so both write the same file.
+  uint depth = 0;
+  for (uint subdivision : subtreeOrder) depth = std::max<uint>(depth, mLevelCounts[subdivision].size());
+  std::vector<std::vector<uint64_t>> bases(mRoots.size()); // Index of each subtree level's first node
+  uint64_t indicesSize = order.size();
+  for (uint level = 0; level < depth; ++level) {
+    for (uint subdivision : subtreeOrder) {
+      if (level >= mLevelCounts[subdivision].size()) continue;
+      bases[subdivision].push_back(indicesSize);
+      indicesSize += mLevelCounts[subdivision][level];
+    }
+  }
+  if (Octree::isLeaf(root)) indicesSize = 1;
+  if (indicesSize >= paletteStart) throw std::runtime_error("Octree is too large for vm8");
+
+  std::println("Merging {} spilled subtrees into: \e[1;3;4;33m{}\e[0m", subtreeOrder.size(), pPath);
+
+  std::ofstream fout;
+  fout.open(pPath, std::ios::out | std::ios::binary);
+  if (!fout.is_open()) throw std::runtime_error("Could not open output file");
+
+  // Header
+  fout << "VMESH8";
+  const uint32_t fileVersion = 100;
+  fout.write(reinterpret_cast<const char*>(&fileVersion), sizeof(fileVersion));
+  // Resolution
+  fout.write(reinterpret_cast<char*>(&mResolution), sizeof(uint32_t));
+  // Palette size
+  fout.write(reinterpret_cast<char*>(&pPaletteSize), sizeof(uint32_t));
+  // Indices
+  const uint32_t count = indicesSize;
+  fout.write(reinterpret_cast<const char*>(&count), sizeof(uint32_t));
+
+  std::vector<std::array<uint32_t, 8>> buffer;
+  if (Octree::isLeaf(root)) buffer.emplace_back().fill(paletteStart + (root & ~Octree::LEAF_BIT));
+  for (uint32_t node : order) {
+    std::array<uint32_t, 8>& n = buffer.emplace_back();
+    for (uint i = 0; i < 8; ++i) {
+      const uint32_t c = top[node][i];
+      if (Octree::isLeaf(c)) n[i] = paletteStart + (c & ~Octree::LEAF_BIT);
+      else if (isSubtree(c)) n[i] = bases[c & ~SUBTREE_BIT][0];
+      else n[i] = topIndices[c];
+    }
+  }
+  fout.write(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+
+  // Stream each subtree level in, a level's children are the next level so they're offset by where that starts
+  buffer.resize(READ_BUFFER_NODES);
+  std::vector<uint64_t> levelStarts(mRoots.size(), 0); // Index in the spill file of each subtree's current level
+  for (uint level = 0; level < depth; ++level) {
+    for (uint subdivision : subtreeOrder) {
+      const std::vector<uint32_t>& levelCounts = mLevelCounts[subdivision];
+      if (level >= levelCounts.size()) continue;
+      const uint64_t nextStart = levelStarts[subdivision] + levelCounts[level];
+      const uint64_t offset = level + 1 < levelCounts.size() ? bases[subdivision][level + 1] - nextStart : 0;
+      const std::vector<uint32_t>& paletteMap = mPaletteMaps[subdivision];
+
+      std::ifstream fin;
+      fin.open(getSpillPath(subdivision), std::ios::in | std::ios::binary);
+      if (!fin.is_open()) throw std::runtime_error("Could not open spill file");
+      fin.seekg(levelStarts[subdivision] * sizeof(buffer[0]));
+      for (uint64_t remaining = levelCounts[level]; remaining;) {
+        const size_t n = std::min<uint64_t>(remaining, READ_BUFFER_NODES);
+        fin.read(reinterpret_cast<char*>(buffer.data()), n * sizeof(buffer[0]));
+        if (!fin) throw std::runtime_error("Spill file is truncated");
+        for (size_t i = 0; i < n; ++i)
+          for (uint32_t& c : buffer[i])
+            c = !Octree::isLeaf(c) ? offset + c : paletteStart + (paletteMap.empty() ? c & ~Octree::LEAF_BIT : paletteMap[c & ~Octree::LEAF_BIT]);
+        fout.write(reinterpret_cast<char*>(buffer.data()), n * sizeof(buffer[0]));
+        remaining -= n;
+      }
+      levelStarts[subdivision] = nextStart;
+    }
+  }
+
+  for (uint subdivision : subtreeOrder) {
+    std::filesystem::remove(getSpillPath(subdivision));
+    mRoots[subdivision] = Octree::toLeaf(0);
+  }
+
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write output file");
+  std::println("Writing took: {}", t.getTime());
+  return collapsedCount;
+}
+
+uint64_t SubtreeSpill::getSpilledBytes() const {
+  uint64_t bytes = 0;
+  for (uint32_t count : mNodeCounts) bytes += count * 8ull * sizeof(uint32_t);
+  return bytes;
+}
+
+std::filesystem::path SubtreeSpill::getSpillPath(uint pSubdivision) const {
+  return mDirectory / ("vmesh-" + std::to_string(getpid()) + "-" + std::to_string(mInstance) + "-" + std::to_string(pSubdivision) + ".spill");
+}
@@ -0,0 +1,71 @@
+#include "trace.hpp"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <format>
+#include <stdexcept>
+
+namespace {
+  // Events are appended without locking to a buffer owned by each thread, the buffers outlive their threads
+  struct ThreadBuffer {
+    uint id;
+    std::string name;
+    std::vector<TraceEvent> events;
+  };
+
+  std::mutex buffersMutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  std::chrono::steady_clock::time_point traceStart;
+
+  ThreadBuffer& getThreadBuffer() {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+      std::lock_guard<std::mutex> lock(buffersMutex);
+      buffer = buffers.emplace_back(std::make_unique<ThreadBuffer>()).get();
+      buffer->id = buffers.size();
+      buffer->name = std::format("thread {}", buffer->id);
+    }
+    return *buffer;
+  }
+}
+
+void startTrace() {
+  traceStart = std::chrono::steady_clock::now();
+  isTraceEnabled = true;
+}
+
+void setTraceThreadName(const std::string& pName) {
+  if (!isTraceEnabled.load(std::memory_order_relaxed)) return;
+  getThreadBuffer().name = pName;
+}
+
+void addTraceEvent(const TraceEvent& pEvent) {
+  getThreadBuffer().events.push_back(pEvent);
+}
+
+void writeTrace(const std::string& pPath) {
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  auto toMicroseconds = [](std::chrono::steady_clock::duration pTime) { return std::chrono::duration<double, std::micro>(pTime).count(); };
+
+  std::ofstream fout;
+  fout.open(pPath, std::ios::out);
+  if (!fout.is_open()) throw std::runtime_error("Could not open trace file");
+
+  fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  fout << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"vmesh\"}}";
+  for (const std::unique_ptr<ThreadBuffer>& buffer : buffers) {
+    fout << std::format(",\n  {{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}", buffer->id, buffer->name);
+    fout << std::format(",\n  {{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"sort_index\": {}}}}}", buffer->id, buffer->id);
+    for (const TraceEvent& e : buffer->events) {
+      fout << std::format(",\n  {{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}", e.name, buffer->id, toMicroseconds(e.begin - traceStart), toMicroseconds(e.end - e.begin));
+      if (e.index >= 0) fout << std::format(", \"args\": {{\"index\": {}}}", e.index);
+      fout << "}";
+    }
+  }
+  fout << "\n]}\n";
+
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write trace file");
+}
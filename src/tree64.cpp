@@ -0,0 +1,253 @@
+#include <tree64.hpp>
+#include <octree.hpp>
+#include <trace.hpp>
+
+Tree64::Tree64(uint pResolution, uint pPaletteSize)
+:mResolution(pResolution), mPaletteSize(pPaletteSize) {}
+
+Tree64::Tree64(VMesh::VoxelGrid& pGrid, std::atomic<uint64_t>* pCompletedCount)
+:mPaletteSize(pGrid.mPalette.size()) {
+  TRACE_SCOPE("Tree64::Tree64");
+  for (mResolution = 1; mResolution < pGrid.getResolution(); mResolution <<= 2) {}
+
+  std::atomic<uint64_t> completedCount;
+  if (!pCompletedCount)
+    pCompletedCount = &completedCount;
+
+  const uint64_t volume = uint64_t(mResolution) * mResolution * mResolution;
+  const uint gridResolution = pGrid.getResolution();
+
+  if (pGrid.getVoxelCount() == 0 || mResolution == 1) {
+    mRoot = toLeaf(pGrid.queryVoxelData(glm::uvec3(0)));
+    pCompletedCount->fetch_add(volume, std::memory_order_relaxed);
+    return;
+  }
+
+  // Same approach as the octree but with 4x4x4 blocks, every 64 consecutive morton codes are siblings.
+  // Children arrive in morton order so they're placed by their child index as they come in.
+  std::array<glm::uvec3, 64> mortonPos;
+  std::array<uint8_t, 64> mortonToChild;
+  for (uint i = 0; i < 64; ++i) {
+    mortonPos[i] = Octree::fromMorton(i);
+    mortonToChild[i] = toChildIndex(mortonPos[i]);
+  }
+
+  auto collapse = [&](const std::array<uint32_t, 64>& pChildren) -> uint32_t {
+    bool isUniform = isLeaf(pChildren[0]); // Only leaves can be equal, nodes are unique
+    for (uint i = 1; i < 64 && isUniform; ++i) isUniform = pChildren[i] == pChildren[0];
+    if (isUniform) return pChildren[0];
+    Node64& n = mNodes.emplace_back();
+    n.first = mChildren.size();
+    for (uint i = 0; i < 64; ++i) {
+      if (pChildren[i] == toLeaf(0)) continue;
+      n.mask |= 1ull << i;
+      mChildren.push_back(pChildren[i]);
+    }
+    return mNodes.size() - 1;
+  };
+
+  const uint depth = std::countr_zero(mResolution) >> 1;
+  std::vector<std::array<uint32_t, 64>> levels(depth + 1);
+  std::vector<uint8_t> levelSizes(depth + 1, 0);
+
+  auto push = [&](uint pLevel, uint32_t pHandle) {
+    levels[pLevel][mortonToChild[levelSizes[pLevel]++]] = pHandle;
+    while (pLevel < depth && levelSizes[pLevel] == 64) {
+      levelSizes[pLevel] = 0;
+      uint32_t h = collapse(levels[pLevel]);
+      ++pLevel;
+      levels[pLevel][mortonToChild[levelSizes[pLevel]++]] = h;
+    }
+  };
+
+  const uint64_t blockCount = volume >> 6;
+  std::array<uint32_t, 64> voxels;
+  for (uint64_t block = 0; block < blockCount; ++block) {
+    const glm::uvec3 origin = Octree::fromMorton(block) * 4u;
+    for (uint i = 0; i < 64; ++i) {
+      const glm::uvec3 pos = origin + mortonPos[i];
+      voxels[mortonToChild[i]] = toLeaf(pos.x < gridResolution && pos.y < gridResolution && pos.z < gridResolution ? pGrid.queryVoxelData(pos) : 0);
+    }
+    push(1, collapse(voxels));
+    if ((block + 1) % PROGRESS_BATCH == 0) pCompletedCount->fetch_add(PROGRESS_BATCH * 64, std::memory_order_relaxed);
+  }
+  pCompletedCount->fetch_add(blockCount % PROGRESS_BATCH * 64, std::memory_order_relaxed);
+
+  mRoot = levels[depth][0];
+}
+
+void Tree64::attach(Tree64& pTree, glm::uvec3& pOrigin) {
+  TRACE_SCOPE("Tree64::attach");
+  if (pTree.getResolution() > mResolution) throw std::runtime_error("Can't attach a larger 64tree");
+
+  // Append the subtrees nodes and children to the pool
+  const uint32_t nodeOffset = mNodes.size();
+  const uint32_t childOffset = mChildren.size();
+  for (Node64 n : pTree.mNodes) {
+    n.first += childOffset;
+    mNodes.push_back(n);
+  }
+  for (uint32_t c : pTree.mChildren)
+    mChildren.push_back(isLeaf(c) ? c : c + nodeOffset);
+  const uint32_t root = isLeaf(pTree.mRoot) ? pTree.mRoot : pTree.mRoot + nodeOffset;
+
+  // Walk down to the slot the subtree replaces, splitting leaves on the way
+  uint32_t parent = NO_NODE;
+  uint8_t childIndex = 0;
+  auto get = [&]() { return parent == NO_NODE ? mRoot : getChild(parent, childIndex); };
+  auto set = [&](uint32_t pHandle) {
+    if (parent == NO_NODE) mRoot = pHandle;
+    else setChild(parent, childIndex, pHandle);
+  };
+  glm::uvec3 o(0);
+  for (uint size = mResolution >> 2; size >= pTree.getResolution(); size >>= 2) {
+    uint32_t h = get();
+    if (isLeaf(h)) {
+      Node64& n = mNodes.emplace_back();
+      if (h != toLeaf(0)) {
+        n.mask = ~0ull;
+        n.first = mChildren.size();
+        mChildren.insert(mChildren.end(), 64, h);
+      }
+      set(h = mNodes.size() - 1);
+    }
+    parent = h;
+    childIndex = toChildIndex((pOrigin - o) / size);
+    o += toChildPos(childIndex) * size;
+  }
+  set(root);
+}
+
+uint32_t Tree64::getChild(uint32_t pNode, uint pChildIndex) {
+  const Node64& n = mNodes[pNode];
+  const uint64_t bit = 1ull << pChildIndex;
+  if (!(n.mask & bit)) return toLeaf(0);
+  return mChildren[n.first + std::popcount(n.mask & (bit - 1))];
+}
+
+void Tree64::setChild(uint32_t pNode, uint pChildIndex, uint32_t pHandle) {
+  const uint64_t bit = 1ull << pChildIndex;
+  Node64& n = mNodes[pNode];
+  if (n.mask & bit && pHandle != toLeaf(0)) {
+    mChildren[n.first + std::popcount(n.mask & (bit - 1))] = pHandle;
+    return;
+  }
+  if (!(n.mask & bit) && pHandle == toLeaf(0)) return;
+
+  // The set of present children changes so repack them at the end, the old range is left unused
+  std::array<uint32_t, 64> children;
+  uint count = 0;
+  for (uint i = 0; i < 64; ++i) {
+    uint32_t c = i == pChildIndex ? pHandle : getChild(pNode, i);
+    if (c != toLeaf(0)) children[count++] = c;
+  }
+  n.mask ^= bit;
+  n.first = mChildren.size();
+  mChildren.insert(mChildren.end(), children.begin(), children.begin() + count);
+}
+
+uint64_t Tree64::writeWords(std::ofstream& pOut) {
+  TRACE_SCOPE("Tree64::writeWords");
+  const uint32_t paletteStart = std::numeric_limits<uint32_t>::max() - mPaletteSize;
+  std::vector<uint32_t> buffer;
+  buffer.reserve(WRITE_BUFFER_WORDS + 66);
+  auto flush = [&]() {
+    pOut.write(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(uint32_t));
+    buffer.clear();
+  };
+
+  // A uniform 64tree still needs a root node
+  if (isLeaf(mRoot)) {
+    const uint64_t mask = mRoot == toLeaf(0) ? 0 : ~0ull;
+    buffer.push_back(mask);
+    buffer.push_back(mask >> 32);
+    if (mask) buffer.insert(buffer.end(), 64, paletteStart + (mRoot & ~LEAF_BIT));
+    flush();
+    return mask ? 66 : 2;
+  }
+
+  // Nodes are written breadth first, a node's offset is known as soon as it's queued since its size only depends on its mask
+  auto nodeSize = [&](uint32_t pNode) { return 2ull + std::popcount(mNodes[pNode].mask); };
+  std::vector<uint32_t> queue = {mRoot};
+  uint64_t offset = nodeSize(mRoot);
+  for (uint i = 0; i < queue.size(); ++i) {
+    const Node64& n = mNodes[queue[i]];
+    buffer.push_back(n.mask);
+    buffer.push_back(n.mask >> 32);
+    const uint count = std::popcount(n.mask);
+    for (uint j = 0; j < count; ++j) {
+      const uint32_t c = mChildren[n.first + j];
+      if (isLeaf(c)) buffer.push_back(paletteStart + (c & ~LEAF_BIT));
+      else {
+        if (offset >= paletteStart) throw std::runtime_error("64tree is too large for vm64");
+        buffer.push_back(offset);
+        offset += nodeSize(c);
+        queue.push_back(c);
+      }
+    }
+    if (buffer.size() >= WRITE_BUFFER_WORDS) flush();
+  }
+  flush();
+
+  return offset;
+}
+
+void Tree64::remapPalette(const std::vector<uint32_t>& pMap, uint pPaletteSize) {
+  TRACE_SCOPE("Tree64::remapPalette");
+  if (isLeaf(mRoot)) mRoot = toLeaf(pMap[mRoot & ~LEAF_BIT]);
+  for (uint32_t& child : mChildren)
+    if (isLeaf(child)) child = toLeaf(pMap[child & ~LEAF_BIT]);
+  mPaletteSize = pPaletteSize;
+}
+
+void Tree64::resizePalette(uint pSize) {
+  mPaletteSize = pSize;
+}
+
+uint Tree64::getResolution() {
+  return mResolution;
+}
+
+uint Tree64::getNodeCount() {
+  return mNodes.size();
+}
+
+void Tree64::write(std::string pPath) {
+  TRACE_SCOPE("Tree64::write");
+  // Write 64tree
+  pPath.append(".vm64");
+  VMesh::Timer t;
+  std::println("Writing 64tree to: \e[1;3;4;33m{}\e[0m", pPath);
+
+  std::ofstream fout;
+  fout.open(pPath, std::ios::out | std::ios::binary);
+  if (!fout.is_open()) throw std::runtime_error("Could not open output file");
+
+  // Header
+  fout << "VMESH64";
+  const uint32_t fileVersion = 100;
+  fout.write(reinterpret_cast<const char*>(&fileVersion), sizeof(fileVersion));
+  // Resolution
+  fout.write(reinterpret_cast<char*>(&mResolution), sizeof(uint32_t));
+  // Palette size
+  fout.write(reinterpret_cast<char*>(&mPaletteSize), sizeof(uint32_t));
+  // Words, the count is patched in once the nodes are written
+  std::streampos wordCountPos = fout.tellp();
+  uint32_t wordCount = 0;
+  fout.write(reinterpret_cast<char*>(&wordCount), sizeof(uint32_t));
+  wordCount = writeWords(fout);
+  fout.seekp(wordCountPos);
+  fout.write(reinterpret_cast<char*>(&wordCount), sizeof(uint32_t));
+
+  fout.close();
+  if (fout.fail()) throw std::runtime_error("Could not write output file");
+  std::println("Writing took: {}", t.getTime());
+}
+
+uint Tree64::toChildIndex(const glm::uvec3& pPos) {
+  return std::min(pPos.x, 3u) | std::min(pPos.y, 3u) << 2 | std::min(pPos.z, 3u) << 4; // Index in children 0 - 63
+}
+
+glm::uvec3 Tree64::toChildPos(uint8_t pChildIndex) {
+  return glm::uvec3(pChildIndex & 3, (pChildIndex >> 2) & 3, (pChildIndex >> 4) & 3);
+}
@@ -0,0 +1,68 @@
+#include "triangleBins.hpp"
+#include "trace.hpp"
+
+template<class F> void TriangleBins::bin(std::span<const MeshView> pMeshes, const glm::uvec3& pOrigin, F&& pForEach) {
+  const uint cellCount = mSubdimensions * mSubdimensions * mSubdimensions;
+  mOffsets.assign(cellCount + 1, 0);
+
+  // Cell range a triangle touches, padded by a voxel either side since voxelization rounds positions to voxels
+  auto forEachCell = [&](const TriangleRef& pRef, auto&& pFunc) {
+    const MeshView& m = pMeshes[pRef.mesh];
+    const glm::vec3& a = m.getPosition(m.indices[pRef.index]);
+    const glm::vec3& b = m.getPosition(m.indices[pRef.index + 1]);
+    const glm::vec3& c = m.getPosition(m.indices[pRef.index + 2]);
+    const glm::vec3 lo = glm::min(a, glm::min(b, c)) - glm::vec3(pOrigin) - glm::vec3(1);
+    const glm::vec3 hi = glm::max(a, glm::max(b, c)) - glm::vec3(pOrigin) + glm::vec3(1);
+    const float maxCell = mSubdimensions - 1;
+    const glm::uvec3 from(glm::clamp(glm::floor(lo / float(mSubdivisionSize)), glm::vec3(0), glm::vec3(maxCell)));
+    const glm::uvec3 to(glm::clamp(glm::floor(hi / float(mSubdivisionSize)), glm::vec3(0), glm::vec3(maxCell)));
+    for (uint x = from.x; x <= to.x; ++x) for (uint y = from.y; y <= to.y; ++y) for (uint z = from.z; z <= to.z; ++z)
+      pFunc(toCell({x, y, z}));
+  };
+
+  // Count, prefix sum then fill
+  pForEach([&](const TriangleRef& pRef) { forEachCell(pRef, [&](uint pCell) { ++mOffsets[pCell + 1]; }); });
+  for (uint i = 0; i < cellCount; ++i) mOffsets[i + 1] += mOffsets[i];
+  mTriangles.resize(mOffsets.back());
+  std::vector<uint64_t> fill(mOffsets.begin(), mOffsets.end() - 1);
+  pForEach([&](const TriangleRef& pRef) { forEachCell(pRef, [&](uint pCell) { mTriangles[fill[pCell]++] = pRef; }); });
+}
+
+TriangleBins::TriangleBins(std::span<const MeshView> pMeshes, uint pSubdivisionSize, uint pSubdimensions)
+:mSubdivisionSize(pSubdivisionSize), mSubdimensions(pSubdimensions) {
+  TRACE_SCOPE("TriangleBins::TriangleBins");
+  bin(pMeshes, glm::uvec3(0), [&](auto&& pFunc) {
+    for (uint i = 0; i < pMeshes.size(); ++i)
+      for (uint j = 0; j + 2 < pMeshes[i].indexCount; j += 3) pFunc(TriangleRef{i, j});
+  });
+}
+
+TriangleBins::TriangleBins(std::span<const MeshView> pMeshes, std::span<const TriangleRef> pTriangles, const glm::uvec3& pOrigin, uint pSubdivisionSize, uint pSubdimensions)
+:mSubdivisionSize(pSubdivisionSize), mSubdimensions(pSubdimensions) {
+  TRACE_SCOPE("TriangleBins::TriangleBins");
+  bin(pMeshes, pOrigin, [&](auto&& pFunc) {
+    for (const TriangleRef& t : pTriangles) pFunc(t);
+  });
+}
+
+std::span<const TriangleRef> TriangleBins::getTriangles(uint pCell) const {
+  return std::span<const TriangleRef>(mTriangles.data() + mOffsets[pCell], mOffsets[pCell + 1] - mOffsets[pCell]);
+}
+
+uint TriangleBins::getTriCount(uint pCell) const {
+  return mOffsets[pCell + 1] - mOffsets[pCell];
+}
+
+uint TriangleBins::getCellCount() const {
+  return mOffsets.size() - 1;
+}
+
+uint TriangleBins::getEmptyCellCount() const {
+  uint count = 0;
+  for (uint i = 0; i < getCellCount(); ++i) count += getTriCount(i) == 0;
+  return count;
+}
+
+uint TriangleBins::toCell(const glm::uvec3& pCellPos) const {
+  return (pCellPos.x * mSubdimensions + pCellPos.y) * mSubdimensions + pCellPos.z;
+}
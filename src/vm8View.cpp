@@ -0,0 +1,196 @@
+#include "vm8View.hpp"
+#include "compactIndices.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <list>
+#include <random>
+#include <unordered_map>
+
+Vm8View::Vm8View(const std::string& pPath) {
+  mFile = open(pPath.c_str(), O_RDONLY);
+  if (mFile == -1) throw std::runtime_error("Could not open octree file");
+
+  struct stat st;
+  if (fstat(mFile, &st) == -1 || size_t(st.st_size) < HEADER_SIZE) {
+    close(mFile);
+    throw std::invalid_argument("Invalid octree file");
+  }
+  mSize = st.st_size;
+
+  mData = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, mFile, 0);
+  if (mData == MAP_FAILED) {
+    close(mFile);
+    throw std::runtime_error("Could not map octree file");
+  }
+  madvise(mData, mSize, MADV_RANDOM);
+
+  // Check header
+  const char* data = static_cast<const char*>(mData);
+  auto readUint = [&](size_t pOffset) {
+    uint32_t v;
+    std::memcpy(&v, data + pOffset, sizeof(uint32_t));
+    return v;
+  };
+  mVersion = readUint(6);
+  mResolution = readUint(10);
+  mPaletteSize = readUint(14);
+  mNodeCount = readUint(18);
+  mIndices = data + HEADER_SIZE;
+  mAirIndex = std::numeric_limits<uint32_t>::max() - mPaletteSize;
+
+  try {
+    if (std::string(data, 6) != "VMESH8") throw std::invalid_argument("Invalid octree file");
+    if (mVersion < 100 || mVersion > 103) throw std::invalid_argument("Invalid octree file version");
+    if (!mResolution || mResolution & (mResolution - 1) || !mNodeCount) throw std::invalid_argument("Invalid octree file");
+
+    // Compact files are decoded into the same records as every other version
+    if (isCompact()) {
+      uint64_t compactSize;
+      if (mSize < HEADER_SIZE + sizeof(uint64_t)) throw std::invalid_argument("Octree file is truncated");
+      std::memcpy(&compactSize, data + HEADER_SIZE, sizeof(uint64_t));
+      if (mSize < HEADER_SIZE + sizeof(uint64_t) + compactSize) throw std::invalid_argument("Octree file is truncated");
+      mDecoded = decodeCompactIndices(reinterpret_cast<const uint8_t*>(data + HEADER_SIZE + sizeof(uint64_t)), compactSize, mNodeCount, mPaletteSize);
+      mIndices = reinterpret_cast<const char*>(mDecoded.data());
+    }
+    else if (mSize < HEADER_SIZE + size_t(mNodeCount) * 8 * sizeof(uint32_t)) throw std::invalid_argument("Octree file is truncated");
+  }
+  catch (...) {
+    munmap(mData, mSize);
+    close(mFile);
+    throw;
+  }
+}
+
+Vm8View::~Vm8View() {
+  munmap(mData, mSize);
+  close(mFile);
+}
+
+uint Vm8View::lookup(const glm::uvec3& pPos) const {
+  if (pPos.x >= mResolution || pPos.y >= mResolution || pPos.z >= mResolution) throw std::out_of_range("Position is outside of the octree");
+  if (mResolution == 1) return getSingleVoxel();
+  uint32_t node = 0;
+  for (uint size = mResolution >> 1; size; size >>= 1) {
+    uint32_t c = child(node, ((pPos.x & size) != 0) | ((pPos.y & size) != 0) << 1 | ((pPos.z & size) != 0) << 2);
+    if (c >= mAirIndex) return c - mAirIndex;
+    if (c >= mNodeCount) throw std::runtime_error("Invalid node index in octree file");
+    node = c;
+  }
+  throw std::runtime_error("Octree file is deeper than its resolution");
+}
+
+void Vm8View::lookup(const std::vector<glm::uvec3>& pPositions, std::vector<uint>& pValues) const {
+  pValues.resize(pPositions.size());
+  for (size_t i = 0; i < pPositions.size(); ++i)
+    pValues[i] = lookup(pPositions[i]);
+}
+
+void Vm8View::iterateRegion(const glm::uvec3& pMin, const glm::uvec3& pMax, const std::function<void(const glm::uvec3& pOrigin, uint pSize, uint pValue)>& pCallback) const {
+  struct Entry {
+    uint32_t node;
+    glm::uvec3 origin;
+    uint size;
+  };
+  if (mResolution == 1) {
+    if (pMin.x < 1 && pMin.y < 1 && pMin.z < 1 && pMax.x && pMax.y && pMax.z) pCallback(glm::uvec3(0), 1, getSingleVoxel());
+    return;
+  }
+
+  std::vector<Entry> stack = {{0, glm::uvec3(0), mResolution}};
+  while (!stack.empty()) {
+    Entry e = stack.back();
+    stack.pop_back();
+    const uint size = e.size >> 1;
+    if (!size) throw std::runtime_error("Octree file is deeper than its resolution");
+    for (uint i = 0; i < 8; ++i) {
+      const glm::uvec3 origin(e.origin.x + (i & 1) * size, e.origin.y + ((i >> 1) & 1) * size, e.origin.z + ((i >> 2) & 1) * size);
+      if (origin.x >= pMax.x || origin.y >= pMax.y || origin.z >= pMax.z) continue;
+      if (origin.x + size <= pMin.x || origin.y + size <= pMin.y || origin.z + size <= pMin.z) continue;
+      uint32_t c = child(e.node, i);
+      if (c >= mAirIndex) pCallback(origin, size, c - mAirIndex);
+      else if (c >= mNodeCount) throw std::runtime_error("Invalid node index in octree file");
+      else stack.push_back({c, origin, size});
+    }
+  }
+}
+
+Vm8View::TraversalStats Vm8View::measureTraversal(uint pLookups, uint pCacheLines, uint pSeed) const {
+  std::mt19937 rng(pSeed);
+  std::list<uint64_t> lru; // Most recently used first
+  std::unordered_map<uint64_t, std::list<uint64_t>::iterator> cached;
+  uint64_t nodes = 0, lines = 0, misses = 0;
+
+  auto touch = [&](uint64_t pLine) {
+    auto it = cached.find(pLine);
+    if (it != cached.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return;
+    }
+    ++misses;
+    lru.push_front(pLine);
+    cached[pLine] = lru.begin();
+    if (lru.size() > pCacheLines) {
+      cached.erase(lru.back());
+      lru.pop_back();
+    }
+  };
+
+  for (uint i = 0; i < pLookups; ++i) {
+    uint32_t node = 0;
+    uint64_t lastLine = std::numeric_limits<uint64_t>::max();
+    for (uint size = mResolution; size; size >>= 1) {
+      ++nodes;
+      const uint64_t line = size_t(node) * 8 * sizeof(uint32_t) / CACHE_LINE_SIZE;
+      if (line != lastLine) {
+        ++lines;
+        touch(line);
+        lastLine = line;
+      }
+
+      std::array<uint32_t, 8> children;
+      uint childCount = 0;
+      for (uint j = 0; j < 8; ++j) {
+        const uint32_t c = child(node, j);
+        if (c < mAirIndex) {
+          if (c >= mNodeCount) throw std::runtime_error("Invalid node index in octree file");
+          children[childCount++] = c;
+        }
+      }
+      if (!childCount) break;
+      node = children[rng() % childCount];
+    }
+  }
+
+  return {double(nodes) / pLookups, double(lines) / pLookups, double(misses) / pLookups};
+}
+
+uint Vm8View::getSingleVoxel() const {
+  // Written as one node with every child set to the voxel, the children are all the same so child 0 is used
+  const uint32_t c = child(0, 0);
+  if (c < mAirIndex) throw std::runtime_error("Octree file is deeper than its resolution");
+  return c - mAirIndex;
+}
+
+uint Vm8View::getResolution() const {
+  return mResolution;
+}
+
+uint Vm8View::getPaletteSize() const {
+  return mPaletteSize;
+}
+
+uint Vm8View::getVersion() const {
+  return mVersion;
+}
+
+bool Vm8View::isCompact() const {
+  return mVersion == 102 || mVersion == 103;
+}
+
+uint32_t Vm8View::getNodeCount() const {
+  return mNodeCount;
+}
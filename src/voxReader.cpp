@@ -0,0 +1,82 @@
+#include "voxReader.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+
+VoxReader::VoxReader(const std::string& pPath) {
+  mFin.open(pPath, std::ios::binary | std::ios::in);
+  if (!mFin.is_open()) throw std::runtime_error("Could not open magica voxel file");
+
+  char magic[4];
+  uint32_t version;
+  mFin.read(magic, 4);
+  mFin.read(reinterpret_cast<char*>(&version), 4);
+  if (!mFin || std::memcmp(magic, "VOX ", 4)) throw std::runtime_error("Not a magica voxel file");
+
+  // Chunks are an id, content size and children size, MAIN's children are every other chunk so they're read flat
+  bool hasSize = false;
+  char id[4];
+  uint32_t contentSize, childrenSize;
+  while (mFin.read(id, 4) && mFin.read(reinterpret_cast<char*>(&contentSize), 4) && mFin.read(reinterpret_cast<char*>(&childrenSize), 4)) {
+    const std::streamoff contentStart = mFin.tellg();
+    if (!std::memcmp(id, "MAIN", 4)) continue;
+
+    if (!std::memcmp(id, "SIZE", 4) && !hasSize) {
+      uint32_t size[3];
+      mFin.read(reinterpret_cast<char*>(size), sizeof(size));
+      mSize = glm::uvec3(size[0], size[1], size[2]);
+      hasSize = true;
+    }
+    else if (!std::memcmp(id, "XYZI", 4) && mVoxelsOffset < 0) {
+      uint32_t count;
+      mFin.read(reinterpret_cast<char*>(&count), 4);
+      mVoxelCount = count;
+      mVoxelsOffset = contentStart + 4;
+    }
+    else if (!std::memcmp(id, "RGBA", 4)) {
+      // Entry i is colour index i + 1, the last entry can't be used
+      uint8_t rgba[256 * 4];
+      mFin.read(reinterpret_cast<char*>(rgba), sizeof(rgba));
+      for (uint i = 0; i < 255; ++i) mPalette.addColour(glm::vec3(rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2]) / 255.f, -1);
+      mHasPalette = true;
+    }
+    if (!mFin) throw std::runtime_error("Magica voxel file is truncated");
+    mFin.seekg(contentStart + contentSize + childrenSize);
+  }
+  mFin.clear();
+
+  if (!hasSize || mVoxelsOffset < 0) throw std::runtime_error("Magica voxel file has no model");
+}
+
+void VoxReader::readVoxels(const std::function<void(const glm::uvec3& pPos, uint8_t pIndex)>& pCallback) {
+  mFin.seekg(mVoxelsOffset);
+  std::vector<uint8_t> buffer(READ_BUFFER_VOXELS * 4);
+  for (uint64_t read = 0; read < mVoxelCount;) {
+    const uint64_t count = std::min<uint64_t>(READ_BUFFER_VOXELS, mVoxelCount - read);
+    mFin.read(reinterpret_cast<char*>(buffer.data()), count * 4);
+    if (!mFin) throw std::runtime_error("Magica voxel file is truncated");
+    for (uint64_t i = 0; i < count; ++i) {
+      const uint8_t* v = &buffer[i * 4];
+      if (v[0] >= mSize.x || v[1] >= mSize.y || v[2] >= mSize.z) throw std::runtime_error("Magica voxel file has a voxel outside its model");
+      pCallback(glm::uvec3(v[0], v[1], v[2]), v[3]);
+    }
+    read += count;
+  }
+}
+
+const glm::uvec3& VoxReader::getSize() const {
+  return mSize;
+}
+
+uint64_t VoxReader::getVoxelCount() const {
+  return mVoxelCount;
+}
+
+bool VoxReader::hasPalette() const {
+  return mHasPalette;
+}
+
+const ColourPalette& VoxReader::getPalette() const {
+  return mPalette;
+}
@@ -0,0 +1,226 @@
+#include "octree.hpp"
+#include "vm8View.hpp"
+#include "subtreeCache.hpp"
+#include "subtreeSpill.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iterator>
+#include <cmath>
+#include <numbers>
+#include <format>
+#include <cstdlib>
+#include <print>
+
+// Small checks of behaviour that has broken before, each test returns false and says why when it fails
+#define CHECK(pCondition) if (!(pCondition)) { std::println("  {}:{}: {}", __FILE__, __LINE__, #pCondition); return false; }
+
+static std::filesystem::path tmp = std::filesystem::temp_directory_path();
+static std::filesystem::path vmeshPath; // The vmesh binary built next to this one
+
+static std::string readFile(const std::filesystem::path& pPath) {
+  std::ifstream fin(pPath, std::ios::in | std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+}
+
+// Palette indices of a pResolution cube at pOrigin in morton order, a shell of colours 1 to 3 around a sphere of
+// colour 1, with the corner octant solid colour 2 so some subdivisions are uniform
+static std::vector<uint8_t> getTestVoxels(uint pResolution, const glm::uvec3& pOrigin) {
+  std::vector<uint8_t> voxels(uint64_t(pResolution) * pResolution * pResolution, 0);
+  for (uint64_t i = 0; i < voxels.size(); ++i) {
+    const glm::uvec3 p = Octree::fromMorton(i) + pOrigin;
+    const glm::vec3 d = glm::vec3(p) - glm::vec3(40, 43, 41);
+    const float r = std::sqrt(glm::dot(d, d));
+    if (p.x < 32 && p.y < 32 && p.z < 32) voxels[i] = 2;
+    else if (r < 20) voxels[i] = r > 17 ? 1 + (p.x + p.y) % 3 : 1;
+  }
+  return voxels;
+}
+
+// --lods goes down to resolution 1, which is written as a single node with every child set to the voxel
+static bool testVm8ViewResolution1() {
+  // A resolution 2 cube in morton order where colour 2 is the most common
+  const std::vector<uint8_t> voxels = {2, 0, 0, 2, 0, 1, 0, 0};
+  Octree octree(voxels, 2, 2);
+  Octree lod = octree.downsample();
+  CHECK(lod.getResolution() == 1);
+
+  const std::string path = (tmp / "vmesh-test-resolution1").string();
+  lod.write(path);
+  {
+    Vm8View view(path + ".vm8");
+    CHECK(view.getResolution() == 1);
+    CHECK(view.lookup(glm::uvec3(0)) == 2);
+
+    uint count = 0, value = 0;
+    view.iterateRegion(glm::uvec3(0), glm::uvec3(1), [&](const glm::uvec3&, uint pSize, uint pValue) {
+      count += pSize;
+      value = pValue;
+    });
+    CHECK(count == 1 && value == 2);
+
+    count = 0;
+    view.iterateRegion(glm::uvec3(1), glm::uvec3(2), [&](const glm::uvec3&, uint, uint) { ++count; });
+    CHECK(count == 0);
+  }
+  std::filesystem::remove(path + ".vm8");
+  return true;
+}
+
+// Entries that were cut short or aren't subtrees have to be misses rather than crash attach later
+static bool testSubtreeCacheInvalidEntries() {
+  const std::filesystem::path directory = tmp / "vmesh-test-subtree-cache";
+  std::filesystem::remove_all(directory);
+  SubtreeCache cache(directory);
+  Octree octree(getTestVoxels(16, glm::uvec3(48, 32, 32)), 16, 3);
+  cache.store(1, octree, 1);
+  const std::filesystem::path path = std::filesystem::directory_iterator(directory)->path();
+  const uint64_t size = std::filesystem::file_size(path);
+
+  uint64_t voxelCount;
+  {
+    Octree loaded(16, 3);
+    CHECK(cache.load(1, loaded, voxelCount));
+    CHECK(loaded.getNodeCount() == octree.getNodeCount());
+  }
+  {
+    // Its leaves use colours this palette doesn't have
+    Octree loaded(16, 1);
+    CHECK(!cache.load(1, loaded, voxelCount));
+  }
+  {
+    std::filesystem::resize_file(path, size - 8);
+    Octree loaded(16, 3);
+    CHECK(!cache.load(1, loaded, voxelCount));
+  }
+  {
+    std::ofstream fout(path, std::ios::out | std::ios::binary);
+    for (uint64_t i = 0; i < size; ++i) fout.put(char(i * 37));
+  }
+  {
+    Octree loaded(16, 3);
+    CHECK(!cache.load(1, loaded, voxelCount));
+  }
+  CHECK(!cache.load(2, octree, voxelCount));
+  std::filesystem::remove_all(directory);
+  return true;
+}
+
+// --spill-dir has to write the same file as attaching, collapsing and writing in memory, including when colours are
+// merged while attaching
+static bool testSpillMatchesMemory() {
+  const uint resolution = 64;
+  const std::vector<std::vector<uint32_t>> paletteMaps = {{}, {0, 3, 1, 2}, {0, 1, 1, 2}};
+  for (uint level = 0; level <= 3; ++level) {
+    for (const std::vector<uint32_t>& paletteMap : paletteMaps) {
+      const uint subdivisionSize = resolution >> level, subdimensions = 1 << level;
+      const std::string memoryPath = (tmp / "vmesh-test-memory").string(), spillPath = (tmp / "vmesh-test-spill").string();
+      uint spillCollapsedCount;
+      Octree parent(resolution, 3);
+      {
+        SubtreeSpill spill(tmp / "vmesh-test-spill-dir", resolution, subdivisionSize);
+        for (uint subdivision = 0; subdivision < subdimensions * subdimensions * subdimensions; ++subdivision) {
+          glm::uvec3 origin = glm::uvec3(subdivision / (subdimensions * subdimensions), (subdivision / subdimensions) % subdimensions, subdivision % subdimensions) * subdivisionSize;
+          const std::vector<uint8_t> voxels = getTestVoxels(subdivisionSize, origin);
+          if (std::all_of(voxels.begin(), voxels.end(), [](uint8_t pVoxel) { return !pVoxel; })) continue; // Like convert, empty subdivisions aren't attached
+          Octree spilled(voxels, subdivisionSize, 3), attached(voxels, subdivisionSize, 3);
+          spill.add(subdivision, spilled);
+          if (!paletteMap.empty()) {
+            spill.remapPalette(subdivision, paletteMap, 3);
+            attached.remapPalette(paletteMap, 3);
+          }
+          parent.attach(attached, origin);
+        }
+        spillCollapsedCount = spill.write(spillPath, 3);
+      }
+      const uint collapsedCount = level ? parent.collapse() : 0;
+      parent.write(memoryPath);
+
+      CHECK(spillCollapsedCount == collapsedCount);
+      CHECK(readFile(spillPath + ".vm8") == readFile(memoryPath + ".vm8"));
+      std::filesystem::remove(spillPath + ".vm8");
+      std::filesystem::remove(memoryPath + ".vm8");
+    }
+  }
+  std::filesystem::remove_all(tmp / "vmesh-test-spill-dir");
+  return true;
+}
+
+// A sphere with a differently coloured material on each side of its equator
+static void writeTestModel(const std::filesystem::path& pPath) {
+  std::ofstream mtl(pPath.string() + ".mtl");
+  mtl << "newmtl red\nKd 0.9 0.1 0.1\nnewmtl blue\nKd 0.1 0.2 0.9\nnewmtl green\nKd 0.2 0.8 0.3\n";
+
+  std::ofstream obj(pPath.string() + ".obj");
+  obj << std::format("mtllib {}.mtl\n", pPath.filename().string());
+  const uint rings = 24, segments = 48;
+  for (uint i = 0; i <= rings; ++i) {
+    for (uint j = 0; j < segments; ++j) {
+      const float theta = std::numbers::pi * i / rings, phi = 2 * std::numbers::pi * j / segments;
+      obj << std::format("v {} {} {}\n", std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+    }
+  }
+  const char* materials[] = {"red", "blue", "green"};
+  for (uint i = 0; i < rings; ++i) {
+    obj << std::format("usemtl {}\n", materials[i * 3 / rings]);
+    for (uint j = 0; j < segments; ++j) {
+      const uint a = i * segments + j + 1, b = i * segments + (j + 1) % segments + 1;
+      obj << std::format("f {} {} {}\nf {} {} {}\n", a, a + segments, b + segments, a, b + segments, b);
+    }
+  }
+}
+
+// Subdivisions finish in a different order with more jobs, the octree and palette mustn't depend on it
+static bool testJobsMatchOneJob() {
+  CHECK(std::filesystem::exists(vmeshPath));
+  const std::filesystem::path model = tmp / "vmesh-test-model";
+  writeTestModel(model);
+
+  for (const std::string colourArgs : {"-B", "--colour-distance 0.05"}) {
+    std::vector<std::string> outputs;
+    for (uint jobs : {1, 4}) {
+      const std::string out = (tmp / std::format("vmesh-test-j{}", jobs)).string();
+      const std::string command = std::format("\"{}\" \"{}.obj\" \"{}\" -f vm8 -R 64 -L 2 -j {} {} --no-progress > /dev/null", vmeshPath.string(), model.string(), out, jobs, colourArgs);
+      CHECK(std::system(command.c_str()) == 0);
+      outputs.push_back(readFile(out + ".vm8") + readFile(out + ".pal"));
+      std::filesystem::remove(out + ".vm8");
+      std::filesystem::remove(out + ".pal");
+    }
+    CHECK(!outputs[0].empty());
+    CHECK(outputs[0] == outputs[1]);
+  }
+  std::filesystem::remove(model.string() + ".obj");
+  std::filesystem::remove(model.string() + ".mtl");
+  return true;
+}
+
+int main(int argc, char** argv) {
+  vmeshPath = std::filesystem::absolute(argv[0]).parent_path() / "vmesh";
+
+  const std::vector<std::pair<std::string, std::function<bool()>>> tests = {
+    {"Vm8View resolution 1", testVm8ViewResolution1},
+    {"SubtreeCache invalid entries", testSubtreeCacheInvalidEntries},
+    {"SubtreeSpill matches memory", testSpillMatchesMemory},
+    {"-j N matches -j 1", testJobsMatchOneJob}
+  };
+
+  uint failedCount = 0;
+  for (const auto& [name, test] : tests) {
+    bool isPassed;
+    try {
+      isPassed = test();
+    }
+    catch (std::exception& pErr) {
+      std::println("  threw: {}", pErr.what());
+      isPassed = false;
+    }
+    std::println("{}: {}", isPassed ? "passed" : "FAILED", name);
+    failedCount += !isPassed;
+  }
+  std::println("{}/{} tests passed", tests.size() - failedCount, tests.size());
+  return failedCount ? 1 : 0;
+}